@@ -0,0 +1,276 @@
+#include "Netpbm.h"
+
+#include <cctype>
+#include <climits>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#else
+#include <filesystem>
+#endif
+
+namespace Netpbm {
+    /**MappedFile definitions*/
+    MappedFile::MappedFile() : begin(nullptr), length(0) {}
+
+    MappedFile::~MappedFile() {
+        close();
+    }
+
+    bool MappedFile::open(const char *path) {
+        close();
+#ifndef _WIN32
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info)) {
+            ::close(fd);
+            return false;
+        }
+        if (info.st_size > 0) {
+            void *mapped = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                return false;
+            }
+            begin = (uchar *) mapped;
+            length = info.st_size;
+        }
+        ::close(fd);
+        return true;
+#else
+        FILE *file = fopen(path, "rb");
+        if (!file)
+            return false;
+        uchar buffer[1 << 16];
+        size_t got;
+        while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            copy.insert(copy.end(), buffer, buffer + got);
+        fclose(file);
+        begin = copy.data();
+        length = copy.size();
+        return true;
+#endif
+    }
+
+    void MappedFile::close() {
+#ifndef _WIN32
+        if (begin)
+            munmap(begin, length);
+#endif
+        copy.clear();
+        begin = nullptr;
+        length = 0;
+    }
+
+    /**Parsing*/
+    // Next unsigned decimal of a header or a plain raster, skipping whitespace and # comments. The character that
+    // ends the number is consumed and returned through end, a comment right after the number counts as a newline.
+    // Returns -1 when there is no number.
+    template<class Next>
+    long long number(Next &next, int &end) {
+        int c = next();
+        while (c == '#' || isspace(c)) {
+            if (c == '#')
+                while (c != '\n' && c != '\r' && c != EOF)
+                    c = next();
+            c = next();
+        }
+        if (!isdigit(c))
+            return -1;
+        long long value = 0;
+        while (isdigit(c)) {
+            value = value * 10 + (c - '0');
+            if (value > INT_MAX)
+                return -1;
+            c = next();
+        }
+        if (c == '#') {
+            while (c != '\n' && c != '\r' && c != EOF)
+                c = next();
+            c = '\n';
+        }
+        end = c;
+        return value;
+    }
+
+    template<class Next>
+    Status parseHeader(Next &next, Header &header) {
+        if (next() != 'P')
+            return BAD_HEADER;
+        int kind = next();
+        if (kind < '2' || kind > '6' || kind == '4')
+            return BAD_HEADER;
+        header.channels = kind == '3' || kind == '6' ? 3 : 1;
+        header.plain = kind <= '3';
+        int end;
+        long long width = number(next, end);
+        long long height = number(next, end);
+        long long maxval = number(next, end);
+        // exactly one whitespace character separates the header from a binary raster
+        if (width <= 0 || height <= 0 || maxval <= 0 || maxval > 65535 || !isspace(end))
+            return BAD_HEADER;
+        header.width = width;
+        header.height = height;
+        header.maxval = maxval;
+        return OK;
+    }
+
+    // Decodes count plain samples into the binary layout
+    template<class Next>
+    Status parseSamples(Next &next, const Header &header, uchar *samples, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            int end;
+            long long value = number(next, end);
+            if (value < 0 || value > header.maxval)
+                return TRUNCATED;
+            if (header.sampleBytes() == 2) {
+                *samples++ = value >> 8;
+                *samples++ = value & 255;
+            } else
+                *samples++ = value;
+        }
+        return OK;
+    }
+
+    Status read(const char *path, Image &image) {
+        if (!image.file.open(path))
+            return CANNOT_OPEN;
+        const uchar *cursor = image.file.data(), *end = cursor + image.file.size();
+        auto next = [&]() {
+            return cursor < end ? *cursor++ : EOF;
+        };
+        Status status = parseHeader(next, image.header);
+        if (status != OK)
+            return status;
+        if (image.header.plain) {
+            image.decoded.resize(image.header.bytes());
+            image.pixels = image.decoded.data();
+            return parseSamples(next, image.header, image.pixels,
+                                (size_t) image.header.width * image.header.height * image.header.channels);
+        }
+        if ((size_t) (end - cursor) < image.header.bytes())
+            return TRUNCATED;
+        image.pixels = image.file.data() + (cursor - image.file.data());
+        return OK;
+    }
+
+    Status readHeader(FILE *file, Header &header) {
+        auto next = [&]() {
+            return fgetc(file);
+        };
+        return parseHeader(next, header);
+    }
+
+    Status readSamples(FILE *file, const Header &header, uchar *samples, size_t count) {
+        if (header.plain) {
+            auto next = [&]() {
+                return fgetc(file);
+            };
+            return parseSamples(next, header, samples, count);
+        }
+        size_t bytes = count * header.sampleBytes();
+        return fread(samples, 1, bytes, file) == bytes ? OK : TRUNCATED;
+    }
+
+    void decode16(const uchar *samples, uint16_t *values, size_t count, int maxval) {
+        for (size_t i = 0; i < count; i++) {
+            unsigned int value = samples[2 * i] << 8 | samples[2 * i + 1];
+            values[i] = maxval == 65535 ? value : (value * 65535 + maxval / 2) / maxval;
+        }
+    }
+
+    void encode16(const uint16_t *values, uchar *samples, size_t count, int maxval) {
+        for (size_t i = 0; i < count; i++) {
+            unsigned int value = maxval == 65535 ? values[i] : (values[i] * (unsigned int) maxval + 32767) / 65535;
+            samples[2 * i] = value >> 8;
+            samples[2 * i + 1] = value & 255;
+        }
+    }
+
+    bool sameFile(const char *first, const char *second) {
+#ifndef _WIN32
+        struct stat a, b;
+        return !stat(first, &a) && !stat(second, &b) && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+#else
+        std::error_code error;
+        return std::filesystem::equivalent(first, second, error);
+#endif
+    }
+
+    /**Writing*/
+    std::string formatHeader(const Header &header) {
+        char text[64];
+        snprintf(text, sizeof(text), "P%c\n%i %i\n%i\n", header.format(), header.width, header.height, header.maxval);
+        return text;
+    }
+
+#ifndef _WIN32
+    // writev until every part is out, a short write leaves the rest of the current part and the parts after it
+    bool writeParts(int fd, struct iovec *part, int left) {
+        while (left > 0) {
+            ssize_t written = writev(fd, part, left);
+            if (written < 0)
+                return false;
+            while (left > 0 && (size_t) written >= part->iov_len) {
+                written -= part->iov_len;
+                part++;
+                left--;
+            }
+            if (left > 0) {
+                part->iov_base = (char *) part->iov_base + written;
+                part->iov_len -= written;
+            }
+        }
+        return true;
+    }
+#endif
+
+    // A regular file is written under a temporary name and renamed over the target, so an input mapped from the
+    // same path keeps its pages while they are written out. Pipes and devices are written directly.
+    Status write(const char *path, const Header &header, const uchar *pixels) {
+        std::string text = formatHeader(header);
+        size_t bytes = header.bytes();
+#ifndef _WIN32
+        struct stat info;
+        bool direct = !stat(path, &info) && !S_ISREG(info.st_mode);
+        std::string temporary = direct ? path : std::string(path) + ".tmp";
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0)
+            return CANNOT_CREATE;
+        struct iovec parts[2] = {{(void *) text.data(), text.size()}, {(void *) pixels, bytes}};
+        bool written = writeParts(fd, parts, 2);
+        if (::close(fd) || !written || (!direct && rename(temporary.c_str(), path))) {
+            if (!direct)
+                unlink(temporary.c_str());
+            return CANNOT_WRITE;
+        }
+        return OK;
+#else
+        FILE *file = fopen(path, "wb");
+        if (!file)
+            return CANNOT_CREATE;
+        bool written = fwrite(text.data(), 1, text.size(), file) == text.size() &&
+                       fwrite(pixels, 1, bytes, file) == bytes;
+        return fclose(file) || !written ? CANNOT_WRITE : OK;
+#endif
+    }
+
+    bool writeAtomically(const char *path, const uchar *data, size_t bytes) {
+        std::string temporary = std::string(path) + ".tmp";
+        FILE *file = fopen(temporary.c_str(), "wb");
+        if (!file)
+            return false;
+        bool written = fwrite(data, 1, bytes, file) == bytes;
+        if (fclose(file) || !written || rename(temporary.c_str(), path)) {
+            remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef COMMON_NETPBM_H
+#define COMMON_NETPBM_H
+
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// PGM/PPM reading and writing shared by the labs. Inputs are memory-mapped and the pixels are handed out in place,
+// outputs go to the file with a single writev.
+namespace Netpbm {
+    typedef unsigned char uchar;
+
+    enum Status {
+        OK, CANNOT_OPEN, BAD_HEADER, TRUNCATED, CANNOT_CREATE, CANNOT_WRITE
+    };
+
+    // A file mapped copy-on-write: writes to data() stay private to the process. Read into memory on Windows.
+    class MappedFile {
+    public:
+        MappedFile();
+        ~MappedFile();
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        bool open(const char *path);
+        void close();
+        uchar *data() const { return begin; }
+        size_t size() const { return length; }
+
+    private:
+        uchar *begin;
+        size_t length;
+        std::vector<uchar> copy;
+    };
+
+    struct Header {
+        int width, height, maxval;
+        int channels; // 1 for P2/P5, 3 for P3/P6
+        bool plain;   // P2/P3: samples are decimal text
+
+        int sampleBytes() const { return maxval > 255 ? 2 : 1; }
+        size_t rowBytes() const { return (size_t) width * channels * sampleBytes(); }
+        size_t bytes() const { return rowBytes() * height; }
+        char format() const { return channels == 3 ? '6' : '5'; }
+    };
+
+    // Raster of a file: samples in row order, one byte each or two big-endian bytes when maxval > 255.
+    // pixels points into the mapping when the file is binary and into a decoded copy when it is plain.
+    struct Image {
+        Header header;
+        uchar *pixels;
+        MappedFile file;
+        std::vector<uchar> decoded;
+    };
+
+    Status read(const char *path, Image &image);
+
+    // Header of a stream left at the first sample, for the tools that read row by row
+    Status readHeader(FILE *file, Header &header);
+    // count samples of a stream in the raster layout of Image, plain files included
+    Status readSamples(FILE *file, const Header &header, uchar *samples, size_t count);
+
+    // 16-bit samples between the big-endian file layout and native integers. The values are scaled from 0..maxval to
+    // 0..65535 and back with rounding, so encode16(decode16(x)) gives x back for any maxval.
+    void decode16(const uchar *samples, uint16_t *values, size_t count, int maxval = 65535);
+    void encode16(const uint16_t *values, uchar *samples, size_t count, int maxval = 65535);
+
+    // Whether both paths exist and name the same file, through links too. Tools that write an output while still
+    // reading the input check this first.
+    bool sameFile(const char *first, const char *second);
+
+    // Binary P5/P6 header of the given dimensions
+    std::string formatHeader(const Header &header);
+    Status write(const char *path, const Header &header, const uchar *pixels);
+
+    // bytes of data to a temporary file next to path, renamed over it once complete, so a concurrent reader maps
+    // either the old file or the whole new one. False when any step fails, the temporary is removed then.
+    bool writeAtomically(const char *path, const uchar *data, size_t bytes);
+}
+
+#endif //COMMON_NETPBM_H
@@ -3,35 +3,116 @@
 #include <utility>
 #include <stdlib.h>
 #include <algorithm>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <type_traits>
+#include "../common/Netpbm.h"
 
 typedef unsigned char uchar;
 enum Errors {
-    ARGUMENTS = 1, NO_INPUT, HEADER_PARSING, INPUT_BROKEN, NO_OUTPUT, OUTPUT_ERROR
+    ARGUMENTS = 1, NO_INPUT, HEADER_PARSING, INPUT_BROKEN, NO_OUTPUT, OUTPUT_ERROR, NO_BATCH, BATCH_BROKEN
 };
 enum ARGS {
     INPUT = 1, OUTPUT, BRIGHTNESS, THICKNESS, X_BEGIN, Y_BEGIN, X_END, Y_END, GAMMA
 };
+enum Kernel {
+    WU_DOUBLE, WU_FIXED
+};
+const int TILE_ROWS = 64;
 
-void plot(int x, int y, double c, uchar *data, int width, double brightness, double gamma) {
-    if (gamma == 0) { //sRGB gamma
-        if (brightness <= 0.0031308)
-            data[y * width + x] = 12.92 * brightness * c * 255;
-        else
-            data[y * width + x] = (1.055 * pow(brightness, 1 / 2.4) - 0.055) * c * 255;
-    } else // user-defined gamma
-        data[y * width + x] = pow(brightness, gamma) * c * 255;
+struct Line {
+    double x0, y0, x1, y1;
+    double brightness; // already divided by 255
+    int thickness;
+    double gamma;
+};
+
+// Part of the image a draw call may write to, right and bottom excluded
+struct Tile {
+    int left, top, right, bottom;
+
+    bool contains(int x, int y) const {
+        return x >= left && x < right && y >= top && y < bottom;
+    }
+};
+
+// Gamma-encoded brightness of a single draw call, so pow() runs once per line instead of once per pixel
+struct Transfer {
+    double encoded; // encoded brightness in 0..1
+    double value; // encoded brightness scaled to 0..full
+    int level; // value as stored by plot, for the integer kernels
+    int full;
+    // plotAA scales the background by before, weights it, then scales it by after: full then 1 on the linear
+    // segment of sRGB, 1 then full elsewhere. Multiplying by 1 is exact, so there is no branch per pixel.
+    double before, after;
+
+    // full is the stored value of white: 255 for 8-bit images, 65535 for 16-bit ones
+    Transfer(double brightness, double gamma, int full = 255) : full(full), before(1), after(full) {
+        if (gamma == 0) { //sRGB gamma
+            if (brightness <= 0.0031308) {
+                encoded = 12.92 * brightness;
+                before = full;
+                after = 1;
+            } else
+                encoded = 1.055 * pow(brightness, 1 / 2.4) - 0.055;
+        } else // user-defined gamma
+            encoded = pow(brightness, gamma);
+        value = encoded * full;
+        level = (int) value;
+    }
+};
+
+// Pixel is uchar or uint16_t; the fixed-point kernel keeps as many coverage bits as the pixel has
+template<class Pixel>
+struct Coverage {
+    static const int BITS = sizeof(Pixel) * 8;
+    static const int FULL = (1 << BITS) - 1;
+    typedef typename std::conditional<sizeof(Pixel) == 1, int, long long>::type Product;
+};
+
+// plot and plotAA multiply in the order of the former per-pixel formulas, so every result truncates the same way
+template<class Pixel>
+void plot(int x, int y, double c, Pixel *data, int width, const Transfer &transfer) {
+    data[y * width + x] = transfer.encoded * c * transfer.full;
 }
 
-void plotAA(int x, int y, double alpha, uchar *data, int width, double brightness, double gamma) {
-    double back = data[y * width + x] / 255.0;
-    if (gamma == 0) { //sRGB gamma
-        if (brightness <= 0.0031308)
-            data[y * width + x] = 12.92 * brightness * 255 * alpha + back * 255 * (1 - alpha);
-        else
-            data[y * width + x] = (1.055 * pow(brightness, 1 / 2.4) - 0.055) * 255 * alpha +
-                                  back * (1 - alpha) * 255;
-    } else // user-defined gamma
-        data[y * width + x] = pow(brightness, gamma) * 255 * alpha + back * (1 - alpha) * 255;
+// d / 255.0 of every byte, so the 8-bit blend looks the background up instead of dividing per pixel
+struct ByteFractions {
+    double values[256];
+
+    ByteFractions() {
+        for (int d = 0; d < 256; d++)
+            values[d] = d / 255.0;
+    }
+};
+const ByteFractions byteFractions;
+
+// Stored value as a fraction of full, which is 255 for every 8-bit image
+inline double background(uchar value, int) {
+    return byteFractions.values[value];
+}
+
+inline double background(uint16_t value, int full) {
+    return value / (double) full;
+}
+
+// Blending happens on the stored (encoded) values, so the background needs no conversion
+template<class Pixel>
+void plotAA(int x, int y, double alpha, Pixel *data, int width, const Transfer &transfer) {
+    double back = background(data[y * width + x], transfer.full);
+    data[y * width + x] = transfer.value * alpha + back * transfer.before * (1 - alpha) * transfer.after;
+}
+
+// Same blend as plotAA with an integer coverage in 0..Coverage<Pixel>::FULL
+template<class Pixel>
+void plotAAFixed(int x, int y, int coverage, Pixel *data, int width, const Transfer &transfer) {
+    typedef typename Coverage<Pixel>::Product Product;
+    const int FULL = Coverage<Pixel>::FULL;
+    data[y * width + x] = ((Product) transfer.level * coverage + (Product) data[y * width + x] * (FULL - coverage)) /
+                          FULL;
 }
 
 int iPart_(double x) {
@@ -42,8 +123,8 @@ int round_(double x) {
     return iPart_(x + 0.5);
 }
 
+// Distance above the pixel boundary below x, also for the negative coordinates of a line end just off the image
 double fPart_(double x) {
-    if (x < 0) return x - (iPart_(x) + 1);
     return x - floor(x);
 }
 
@@ -51,73 +132,147 @@ double rfPart_(double x) {
     return 1 - fPart_(x);
 }
 
-void drawLineWuNoAA(double x0, double y0, double x1, double y1, double brightness, uchar *data, int height, int width,
-                    int thickness, double gamma) { //Отрисовка линий без сглаживания (NoAA = No anti-aliasing)
-    bool steep = abs(y1 - y0) > abs(x1 - x0);
-    if (steep) {
-        std::swap(x0, y0);
-        std::swap(x1, y1);
-    }
-    if (x0 > x1) {
-        std::swap(x0, x1);
-        std::swap(y0, y1);
-    }
-
+// Liang-Barsky clip of a segment against [xMin, xMax] x [yMin, yMax]. Returns false if nothing is left.
+// Endpoints that are already inside are not touched, so lines on the canvas are drawn exactly as before.
+bool clipSegment(double &x0, double &y0, double &x1, double &y1, double xMin, double yMin, double xMax, double yMax) {
     double dx = x1 - x0;
     double dy = y1 - y0;
-    double gradient = dy / dx;
-    if (dx == 0)
-        gradient = 1;
-
-    int xEnd = round_(x0);
-    double yEnd = y0 + gradient * (xEnd - x0);
-    double xGap = rfPart_(x0 + 0.5);
-
-    int xpxl1 = xEnd;
-    int ypxl1 = iPart_(yEnd);
-
-    if (steep) {
-        plotAA(ypxl1, xpxl1, rfPart_(yEnd) * xGap, data, width, brightness, gamma);
-        plotAA(ypxl1 + 1, xpxl1, fPart_(yEnd) * xGap, data, width, brightness, gamma);
-    } else {
-        plotAA(xpxl1, ypxl1, rfPart_(yEnd) * xGap, data, width, brightness, gamma);
-        plotAA(xpxl1, ypxl1 + 1, fPart_(yEnd) * xGap, data, width, brightness, gamma);
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {x0 - xMin, xMax - x0, y0 - yMin, yMax - y0};
+    double t0 = 0, t1 = 1;
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0) {
+            if (q[i] < 0)
+                return false;
+        } else if (p[i] < 0) {
+            t0 = std::max(t0, q[i] / p[i]);
+        } else {
+            t1 = std::min(t1, q[i] / p[i]);
+        }
     }
+    if (t0 > t1)
+        return false;
+    double xBegin = x0, yBegin = y0;
+    if (t1 < 1) {
+        x1 = std::min(std::max(xBegin + t1 * dx, xMin), xMax);
+        y1 = std::min(std::max(yBegin + t1 * dy, yMin), yMax);
+    }
+    if (t0 > 0) {
+        x0 = std::min(std::max(xBegin + t0 * dx, xMin), xMax);
+        y0 = std::min(std::max(yBegin + t0 * dy, yMin), yMax);
+    }
+    return true;
+}
 
-    double interY = yEnd + gradient;
-
-    xEnd = round_(x1);
-    yEnd = y1 + gradient * (xEnd - x1);
-    xGap = fPart_(x1 + 0.5);
+// Sutherland-Hodgman step: keeps the part of the polygon where sign * (coordinate - bound) >= 0
+int clipPolygonSide(const double *xs, const double *ys, int n, double *outX, double *outY, bool vertical,
+                    double bound, double sign) {
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        int j = (i + 1) % n;
+        double ci = vertical ? xs[i] : ys[i];
+        double cj = vertical ? xs[j] : ys[j];
+        bool inI = sign * (ci - bound) >= 0;
+        bool inJ = sign * (cj - bound) >= 0;
+        if (inI) {
+            outX[m] = xs[i];
+            outY[m++] = ys[i];
+        }
+        if (inI != inJ) {
+            double t = (bound - ci) / (cj - ci);
+            outX[m] = vertical ? bound : xs[i] + t * (xs[j] - xs[i]);
+            outY[m++] = vertical ? ys[i] + t * (ys[j] - ys[i]) : bound;
+        }
+    }
+    return m;
+}
 
-    int xpxl2 = xEnd;
-    int ypxl2 = iPart_(yEnd);
+// Clips a convex polygon of up to 4 vertices to the pixel area of the image. outX/outY need room for 8 vertices.
+int clipPolygon(const double *xs, const double *ys, int n, double *outX, double *outY, int height, int width) {
+    double tempX[8], tempY[8];
+    n = clipPolygonSide(xs, ys, n, outX, outY, true, -0.5, 1);
+    n = clipPolygonSide(outX, outY, n, tempX, tempY, true, width - 0.5, -1);
+    n = clipPolygonSide(tempX, tempY, n, outX, outY, false, -0.5, 1);
+    n = clipPolygonSide(outX, outY, n, tempX, tempY, false, height - 0.5, -1);
+    for (int i = 0; i < n; i++) {
+        outX[i] = std::min(std::max(tempX[i], -0.5), width - 0.5);
+        outY[i] = std::min(std::max(tempY[i], -0.5), height - 0.5);
+    }
+    return n;
+}
 
+// Plots the two pixels of a line end at major coordinate x, dropping the ones outside the tile
+template<class Pixel>
+void plotLineEnd(bool steep, int x, double yEnd, double xGap, const Transfer &transfer, Pixel *data, int width,
+                 const Tile &tile) {
+    int y = iPart_(yEnd);
     if (steep) {
-        plotAA(ypxl2, xpxl2, rfPart_(yEnd) * xGap, data, width, brightness, gamma);
-        plotAA(ypxl2 + 1, xpxl2, fPart_(yEnd) * xGap, data, width, brightness, gamma);
+        if (tile.contains(y, x))
+            plotAA(y, x, rfPart_(yEnd) * xGap, data, width, transfer);
+        if (tile.contains(y + 1, x))
+            plotAA(y + 1, x, fPart_(yEnd) * xGap, data, width, transfer);
     } else {
-        plotAA(xpxl2, ypxl2, rfPart_(yEnd) * xGap, data, width, brightness, gamma);
-        plotAA(xpxl2, ypxl2 + 1, fPart_(yEnd) * xGap, data, width, brightness, gamma);
+        if (tile.contains(x, y))
+            plotAA(x, y, rfPart_(yEnd) * xGap, data, width, transfer);
+        if (tile.contains(x, y + 1))
+            plotAA(x, y + 1, fPart_(yEnd) * xGap, data, width, transfer);
     }
+}
 
-    if (steep) {
-        for (int x = xpxl1 + 1; x < xpxl2; x++) {
-            plot(iPart_(interY), x, 1, data, width, brightness, gamma);
-            plot(iPart_(interY) + 1, x, 1, data, width, brightness, gamma);
-            interY += gradient;
+// Inner part of the Wu line: major coordinates in [first, last), the minor position derived from xBegin so any tile
+// sees the same y. The caller only leaves CHECKED off for columns whose two pixels are both inside
+// [minorLo, minorHi), so the interior of a span runs without bounds checks.
+template<bool CHECKED, class Pixel>
+void drawSpanWu(bool steep, int xBegin, int first, int last, double interY, double gradient,
+                const Transfer &transfer, Pixel *data, int width, int minorLo, int minorHi) {
+    for (int x = first; x < last; x++) {
+        double y = interY + (x - xBegin) * gradient;
+        int pixel = iPart_(y);
+        double f_part = y - pixel;
+        if (steep) {
+            if (!CHECKED || (pixel >= minorLo && pixel < minorHi))
+                plotAA(pixel, x, 1 - f_part, data, width, transfer);
+            if (!CHECKED || (pixel + 1 >= minorLo && pixel + 1 < minorHi))
+                plotAA(pixel + 1, x, f_part, data, width, transfer);
+        } else {
+            if (!CHECKED || (pixel >= minorLo && pixel < minorHi))
+                plotAA(x, pixel, 1 - f_part, data, width, transfer);
+            if (!CHECKED || (pixel + 1 >= minorLo && pixel + 1 < minorHi))
+                plotAA(x, pixel + 1, f_part, data, width, transfer);
         }
-    } else {
-        for (int x = xpxl1 + 1; x < xpxl2; x++) {
-            plot(x, iPart_(interY), 1, data, width, brightness, gamma);
-            plot(x, iPart_(interY) + 1, 1, data, width, brightness, gamma);
-            interY += gradient;
+    }
+}
+
+// drawSpanWu for the integer kernel: interY and gradient in 16.16 fixed point, coverage with the top
+// Coverage<Pixel>::BITS bits of the fraction (8 for 8-bit images, all 16 for 16-bit ones). The position is 64-bit, so
+// minor coordinates past 32767 do not overflow it.
+template<bool CHECKED, class Pixel>
+void drawSpanWuFixed(bool steep, int xBegin, int first, int last, double interY, double gradient,
+                     const Transfer &transfer, Pixel *data, int width, int minorLo, int minorHi) {
+    const int BITS = Coverage<Pixel>::BITS, FULL = Coverage<Pixel>::FULL;
+    int step = lround(gradient * 65536);
+    long long y = llround(interY * 65536) + (long long) (first - xBegin) * step;
+    for (int x = first; x < last; x++) {
+        int pixel = (int) (y >> 16);
+        int coverage = (int) (y >> (16 - BITS)) & FULL;
+        if (steep) {
+            if (!CHECKED || (pixel >= minorLo && pixel < minorHi))
+                plotAAFixed(pixel, x, FULL - coverage, data, width, transfer);
+            if (!CHECKED || (pixel + 1 >= minorLo && pixel + 1 < minorHi))
+                plotAAFixed(pixel + 1, x, coverage, data, width, transfer);
+        } else {
+            if (!CHECKED || (pixel >= minorLo && pixel < minorHi))
+                plotAAFixed(x, pixel, FULL - coverage, data, width, transfer);
+            if (!CHECKED || (pixel + 1 >= minorLo && pixel + 1 < minorHi))
+                plotAAFixed(x, pixel + 1, coverage, data, width, transfer);
         }
+        y += step;
     }
 }
 
-void drawLineWu(double x0, double y0, double x1, double y1, double brightness, uchar *data, int height, int width,
-                int thickness, double gamma) {
+template<class Pixel>
+void drawLineWu(double x0, double y0, double x1, double y1, const Transfer &transfer, Pixel *data, int height,
+                int width, int thickness, Kernel kernel, const Tile &tile) {
     bool steep = abs(y1 - y0) > abs(x1 - x0);
     if (steep) {
         std::swap(x0, y0);
@@ -134,96 +289,348 @@ void drawLineWu(double x0, double y0, double x1, double y1, double brightness, u
     if (dx == 0)
         gradient = 1;
 
+    // from here on x is the major axis and y the minor one
+    // the clip rectangle reaches a pixel past the image on every side, so a line partly off the image still lights
+    // the border pixels it touches; the pixels outside the image are dropped by the checks against the tile
+    int majorSize = steep ? height : width;
+    int minorSize = steep ? width : height;
+    double xBegin = x0, yBegin = y0, xFinish = x1, yFinish = y1;
+    if (!clipSegment(x0, y0, x1, y1, -1, -1, majorSize, minorSize))
+        return;
+
+    // a clipped end is not an end of the line, so it gets no end weighting and is drawn as part of the span
     int xEnd = round_(x0);
     double yEnd = y0 + gradient * (xEnd - x0);
-    double xGap = rfPart_(x0 + 0.5);
-
     int xpxl1 = xEnd;
-    int ypxl1 = iPart_(yEnd);
-
-    if (steep) {
-        plotAA(ypxl1, xpxl1, rfPart_(yEnd) * xGap, data, width, brightness, gamma);
-        plotAA(ypxl1 + 1, xpxl1, fPart_(yEnd) * xGap, data, width, brightness, gamma);
-    } else {
-        plotAA(xpxl1, ypxl1, rfPart_(yEnd) * xGap, data, width, brightness, gamma);
-        plotAA(xpxl1, ypxl1 + 1, fPart_(yEnd) * xGap, data, width, brightness, gamma);
+    if (x0 == xBegin && y0 == yBegin)
+        plotLineEnd(steep, xpxl1, yEnd, rfPart_(x0 + 0.5), transfer, data, width, tile);
+    else {
+        xpxl1--;
+        yEnd -= gradient;
     }
     double interY = yEnd + gradient;
 
     xEnd = round_(x1);
     yEnd = y1 + gradient * (xEnd - x1);
-    xGap = fPart_(x1 + 0.5);
-
     int xpxl2 = xEnd;
-    int ypxl2 = iPart_(yEnd);
-
-    if (steep) {
-        plotAA(ypxl2, xpxl2, rfPart_(yEnd) * xGap, data, width, brightness, gamma);
-        plotAA(ypxl2 + 1, xpxl2, fPart_(yEnd) * xGap, data, width, brightness, gamma);
+    if (x1 == xFinish && y1 == yFinish)
+        plotLineEnd(steep, xpxl2, yEnd, fPart_(x1 + 0.5), transfer, data, width, tile);
+    else
+        xpxl2 += 2; // the span stops short of xpxl2 - 1
+
+    // the span is restricted to the tile along the major axis, and to the part of the line that comes within
+    // a pixel of the tile along the minor one
+    int first = std::max(xpxl1 + 1, steep ? tile.top : tile.left);
+    int last = std::min(xpxl2 - 1, steep ? tile.bottom : tile.right);
+    int minorLo = steep ? tile.left : tile.top;
+    int minorHi = steep ? tile.right : tile.bottom;
+    if (gradient != 0) {
+        // clamped while still double: a nearly flat line reaches the band far past the int range, or never
+        double enter = xpxl1 + 1 + (minorLo - 1 - interY) / gradient;
+        double leave = xpxl1 + 1 + (minorHi - interY) / gradient;
+        double from = std::max((double) first, floor(std::min(enter, leave)) - 1);
+        double to = std::min((double) last, ceil(std::max(enter, leave)) + 2);
+        if (from >= to)
+            return;
+        first = (int) from;
+        last = (int) to;
+    }
+    // the minor pixel moves monotonically along the span, so the columns with both pixels inside the tile are one
+    // run [inner, innerEnd); only the few columns where the line enters or leaves the tile are checked per pixel
+    int xBeginSpan = xpxl1 + 1;
+    int step = lround(gradient * 65536);
+    long long fixedY = llround(interY * 65536);
+    auto inside = [&](int x) {
+        int pixel = kernel == WU_FIXED ? (int) ((fixedY + (long long) (x - xBeginSpan) * step) >> 16)
+                                       : iPart_(interY + (x - xBeginSpan) * gradient);
+        return pixel >= minorLo && pixel + 1 < minorHi;
+    };
+    int inner = first, innerEnd = std::max(first, last);
+    while (inner < innerEnd && !inside(inner))
+        inner++;
+    while (innerEnd > inner && !inside(innerEnd - 1))
+        innerEnd--;
+    if (kernel == WU_FIXED) {
+        drawSpanWuFixed<true>(steep, xBeginSpan, first, inner, interY, gradient, transfer, data, width, minorLo,
+                              minorHi);
+        drawSpanWuFixed<false>(steep, xBeginSpan, inner, innerEnd, interY, gradient, transfer, data, width, minorLo,
+                               minorHi);
+        drawSpanWuFixed<true>(steep, xBeginSpan, innerEnd, last, interY, gradient, transfer, data, width, minorLo,
+                              minorHi);
     } else {
-        plotAA(xpxl2, ypxl2, rfPart_(yEnd) * xGap, data, width, brightness, gamma);
-        plotAA(xpxl2, ypxl2 + 1, fPart_(yEnd) * xGap, data, width, brightness, gamma);
+        drawSpanWu<true>(steep, xBeginSpan, first, inner, interY, gradient, transfer, data, width, minorLo, minorHi);
+        drawSpanWu<false>(steep, xBeginSpan, inner, innerEnd, interY, gradient, transfer, data, width, minorLo,
+                          minorHi);
+        drawSpanWu<true>(steep, xBeginSpan, innerEnd, last, interY, gradient, transfer, data, width, minorLo, minorHi);
     }
+}
 
-    if (steep) {
-        for (int x = xpxl1 + 1; x < xpxl2 - 1; x++) {
-            double rf_part = rfPart_(interY);
-            double f_part = fPart_(interY);
-            plotAA(iPart_(interY), x, rf_part, data, width, brightness, gamma);
-            plotAA(iPart_(interY) + 1, x, f_part, data, width, brightness, gamma);
-            interY += gradient;
-        }
+// Adds the signed area that the edge (x0, y0)-(x1, y1) covers inside scanline [y, y + 1) to acc.
+// acc[i] holds the coverage change at column left + i; a running sum over the row gives the coverage of each pixel.
+void accumulateEdge(double *acc, int left, int y, double x0, double y0, double x1, double y1, int &minI, int &maxI) {
+    if (y0 == y1)
+        return;
+    double dir = 1;
+    if (y0 > y1) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+        dir = -1;
+    }
+    double top = std::max(y0, (double) y);
+    double bottom = std::min(y1, y + 1.0);
+    if (top >= bottom)
+        return;
+    double dxdy = (x1 - x0) / (y1 - y0);
+    // clamp to the edge's own x range so rounding never reaches outside the polygon's bounding box
+    double xa = std::min(std::max(x0 + (top - y0) * dxdy, std::min(x0, x1)), std::max(x0, x1)) - left;
+    double xb = std::min(std::max(x0 + (bottom - y0) * dxdy, std::min(x0, x1)), std::max(x0, x1)) - left;
+    double d = (bottom - top) * dir;
+    double xl = std::min(xa, xb);
+    double xr = std::max(xa, xb);
+    int il = iPart_(xl);
+    int ir = std::max((int) ceil(xr), il + 1);
+    if (ir == il + 1) { // the edge stays inside one pixel of this scanline
+        double xm = 0.5 * (xa + xb) - il;
+        acc[il] += d * (1 - xm);
+        acc[il + 1] += d * xm;
     } else {
-        for (int x = xpxl1 + 1; x < xpxl2 - 1; x++) {
-            double rf_part = rfPart_(interY);
-            double f_part = fPart_(interY);
-            plotAA(x, iPart_(interY), rf_part, data, width, brightness, gamma);
-            plotAA(x, iPart_(interY) + 1, f_part, data, width, brightness, gamma);
-            interY += gradient;
+        double s = 1 / (xr - xl);
+        double x0f = xl - il;
+        double a0 = 0.5 * s * (1 - x0f) * (1 - x0f);
+        double x1f = xr - ir + 1;
+        double am = 0.5 * s * x1f * x1f;
+        acc[il] += d * a0;
+        if (ir == il + 2) {
+            acc[il + 1] += d * (1 - a0 - am);
+        } else {
+            double a1 = s * (1.5 - x0f);
+            acc[il + 1] += d * (a1 - a0);
+            for (int i = il + 2; i < ir - 1; i++)
+                acc[i] += d * s;
+            double a2 = a1 + (ir - il - 3) * s;
+            acc[ir - 1] += d * (1 - a2 - am);
         }
+        acc[ir] += d * am;
     }
+    minI = std::min(minI, il);
+    maxI = std::max(maxI, ir);
 }
 
+// Fills a polygon with exact area coverage. Every covered pixel is written once, so the cost is O(area).
+// Vertices use the same convention as the line drawing: pixel (x, y) is centered at integer coordinates.
+// The polygon must already be clipped to the image (clipPolygon); only pixels inside the tile are written.
+template<class Pixel>
+void fillPolygon(const double *xs, const double *ys, int n, const Transfer &transfer, Pixel *data, int width,
+                 const Tile &tile) {
+    double minX = xs[0], maxX = xs[0], minY = ys[0], maxY = ys[0];
+    for (int i = 1; i < n; i++) {
+        minX = std::min(minX, xs[i]);
+        maxX = std::max(maxX, xs[i]);
+        minY = std::min(minY, ys[i]);
+        maxY = std::max(maxY, ys[i]);
+    }
+    // shift by half a pixel so that pixel (x, y) covers the unit square [x, x + 1) x [y, y + 1)
+    int left = iPart_(minX + 0.5);
+    int right = (int) ceil(maxX + 0.5);
+    int top = std::max(iPart_(minY + 0.5), tile.top);
+    int bottom = std::min((int) ceil(maxY + 0.5), tile.bottom);
+    if (top >= bottom)
+        return;
+    // kept zeroed between rows and calls, so it only grows and is never cleared in full
+    static thread_local std::vector<double> acc;
+    if (acc.size() < (size_t) (right - left + 2))
+        acc.resize(right - left + 2, 0);
+    for (int y = top; y < bottom; y++) {
+        int minI = (int) acc.size(), maxI = -1;
+        for (int i = 0; i < n; i++) {
+            int j = (i + 1) % n;
+            accumulateEdge(acc.data(), left, y, xs[i] + 0.5, ys[i] + 0.5, xs[j] + 0.5, ys[j] + 0.5, minI, maxI);
+        }
+        if (maxI < 0)
+            continue;
+        // the running sum is back to zero after the last entry, so only [minI, maxI) can be covered;
+        // columns left of the tile are only summed, those right of it only cleared
+        int tileBegin = std::max(minI, tile.left - left);
+        int tileEnd = std::min(maxI, tile.right - left);
+        double coverage = 0;
+        for (int i = minI; i < tileBegin; i++) {
+            coverage += acc[i];
+            acc[i] = 0;
+        }
+        for (int i = tileBegin; i < tileEnd; i++) {
+            coverage += acc[i];
+            acc[i] = 0;
+            double alpha = std::min(std::abs(coverage), 1.0);
+            if (alpha > 1 - 1.0 / 512)
+                plot(left + i, y, 1, data, width, transfer);
+            else if (alpha >= 1.0 / 512)
+                plotAA(left + i, y, alpha, data, width, transfer);
+        }
+        std::fill(acc.begin() + std::max(minI, tileEnd), acc.begin() + maxI + 1, 0.0);
+    }
+}
 
-void drawRectangle(double x0, double y0, double x1, double y1, double brightness, uchar *data, int height, int width,
-                   int thickness, double gamma) {
+// Thick lines are drawn as a filled rectangle around the segment
+template<class Pixel>
+void drawRectangle(double x0, double y0, double x1, double y1, const Transfer &transfer, Pixel *data, int height,
+                   int width, int thickness, const Tile &tile) {
     double dx = x1 - x0;
     double dy = y1 - y0;
     double dist = sqrt(dx * dx + dy * dy);
+    if (dist == 0)
+        return;
     dx /= dist;
     dy /= dist;
-    double a0, b0, a1, b1, a2, b2, a3, b3;
-    a0 = x0 - thickness * dy / 2;
-    b0 = y0 + thickness * dx / 2;
-    a1 = x0 + thickness * dy / 2;
-    b1 = y0 - thickness * dx / 2;
-    a2 = x1 - thickness * dy / 2;
-    b2 = y1 + thickness * dx / 2;
-    a3 = x1 + thickness * dy / 2;
-    b3 = y1 - thickness * dx / 2;
-    drawLineWu(a0, b0, a2, b2, brightness, data, height, width, thickness, gamma);
-    drawLineWu(a1, b1, a3, b3, brightness, data, height, width, thickness, gamma);
-    for (int i = thickness - 2; i >= 0; i--) {
-        a0 = x0 - i * dy / 2;
-        b0 = y0 + i * dx / 2;
-        a1 = x0 + i * dy / 2;
-        b1 = y0 - i * dx / 2;
-        a2 = x1 - i * dy / 2;
-        b2 = y1 + i * dx / 2;
-        a3 = x1 + i * dy / 2;
-        b3 = y1 - i * dx / 2;
-        drawLineWuNoAA(a0, b0, a2, b2, brightness, data, height, width, thickness, gamma);
-        drawLineWuNoAA(a1, b1, a3, b3, brightness, data, height, width, thickness, gamma);
-    }
+    double xs[4] = {x0 - thickness * dy / 2, x1 - thickness * dy / 2, x1 + thickness * dy / 2, x0 + thickness * dy / 2};
+    double ys[4] = {y0 + thickness * dx / 2, y1 + thickness * dx / 2, y1 - thickness * dx / 2, y0 - thickness * dx / 2};
+    double clippedX[8], clippedY[8];
+    int n = clipPolygon(xs, ys, 4, clippedX, clippedY, height, width);
+    if (n >= 3)
+        fillPolygon(clippedX, clippedY, n, transfer, data, width, tile);
 }
 
-void drawLine(double x0, double y0, double x1, double y1, double brightness, uchar *data, int height, int width,
-              int thickness, double gamma) {
+template<class Pixel>
+void drawLine(double x0, double y0, double x1, double y1, const Transfer &transfer, Pixel *data, int height,
+              int width, int thickness, Kernel kernel, const Tile &tile) {
     if (thickness == 1) {
-        drawLineWu(x0, y0, x1, y1, brightness, data, height, width, thickness, gamma);
+        drawLineWu(x0, y0, x1, y1, transfer, data, height, width, thickness, kernel, tile);
         return;
     }
-    drawRectangle(x0, y0, x1, y1, brightness, data, height, width, thickness, gamma);
+    drawRectangle(x0, y0, x1, y1, transfer, data, height, width, thickness, tile);
+}
+
+// Splits the image into bands of TILE_ROWS rows, bins every line into the bands it reaches and lets a pool of
+// threads draw the bands. Each band replays its lines in draw order and every pixel belongs to exactly one band,
+// so the result is byte-identical to drawing the lines one after another. Full-width bands keep every scanline of
+// a thick line inside a single tile, so polygon rows are never computed twice. full is the stored value of white.
+template<class Pixel>
+void drawLines(const std::vector<Line> &lines, Pixel *data, int height, int width, int full, Kernel kernel,
+               int threads) {
+    std::vector<Transfer> transfers;
+    transfers.reserve(lines.size());
+    for (const Line &line : lines)
+        transfers.emplace_back(line.brightness, line.gamma, full);
+    if (threads <= 1) {
+        Tile image = {0, 0, width, height};
+        for (size_t i = 0; i < lines.size(); i++) {
+            const Line &line = lines[i];
+            drawLine(line.x0, line.y0, line.x1, line.y1, transfers[i], data, height, width, line.thickness, kernel,
+                     image);
+        }
+        return;
+    }
+
+    int tiles = (height + TILE_ROWS - 1) / TILE_ROWS;
+    std::vector<std::vector<int>> bins(tiles);
+    for (int i = 0; i < (int) lines.size(); i++) {
+        const Line &line = lines[i];
+        double margin = line.thickness == 1 ? 2 : line.thickness / 2.0 + 2;
+        double top = std::max(std::min(line.y0, line.y1) - margin, 0.0);
+        double bottom = std::min(std::max(line.y0, line.y1) + margin, height - 1.0);
+        for (int t = (int) top / TILE_ROWS; t <= (int) bottom / TILE_ROWS && top <= bottom; t++) {
+            // skip the bands that the widened segment does not reach
+            double x0 = line.x0, y0 = line.y0, x1 = line.x1, y1 = line.y1;
+            if (clipSegment(x0, y0, x1, y1, -margin, t * TILE_ROWS - margin, width - 1 + margin,
+                            (t + 1) * TILE_ROWS + margin))
+                bins[t].push_back(i);
+        }
+    }
+
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int t = next++; t < tiles; t = next++) {
+            Tile tile = {0, t * TILE_ROWS, width, std::min((t + 1) * TILE_ROWS, height)};
+            for (int i : bins[t]) {
+                const Line &line = lines[i];
+                drawLine(line.x0, line.y0, line.x1, line.y1, transfers[i], data, height, width, line.thickness,
+                         kernel, tile);
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread &thread : pool)
+        thread.join();
+}
+
+// Batch file format: one line per record, "x0 y0 x1 y1 brightness thickness gamma" (gamma 0 = sRGB)
+bool readLines(FILE *file, std::vector<Line> &lines) {
+    Line line;
+    double thickness;
+    int parsed;
+    while ((parsed = fscanf(file, "%lf %lf %lf %lf %lf %lf %lf", &line.x0, &line.y0, &line.x1, &line.y1,
+                            &line.brightness, &thickness, &line.gamma)) == 7) {
+        line.brightness /= 255.0;
+        line.thickness = thickness;
+        lines.push_back(line);
+    }
+    return parsed == EOF;
+}
+
+// Pixel throughput of both thin-line kernels on long lines in every octant
+void benchmark() {
+    const int size = 4096, count = 200;
+    std::vector<uchar> canvas(size * size);
+    Tile image = {0, 0, size, size};
+    printf("octant  double Mpx/s  fixed Mpx/s\n");
+    for (int octant = 0; octant < 8; octant++) {
+        printf("%6i", octant);
+        for (Kernel kernel : {WU_DOUBLE, WU_FIXED}) {
+            double pixels = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < count; i++) {
+                double angle = (octant + (i + 0.5) / count) * M_PI / 4;
+                double x0 = size / 2.0, y0 = size / 2.0;
+                double x1 = x0 + (size / 2.0 - 2) * cos(angle), y1 = y0 + (size / 2.0 - 2) * sin(angle);
+                drawLine(x0, y0, x1, y1, Transfer((i % 255) / 255.0, 2.2), canvas.data(), size, size, 1, kernel, image);
+                pixels += 2 * std::max(std::abs(x1 - x0), std::abs(y1 - y0));
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            printf("  %12.1f", pixels / seconds / 1e6);
+        }
+        printf("\n");
+    }
+}
+
+// Banded drawing against sequential drawing on lines that stress the band limits: every octant, lines clipped at
+// the borders, lines just off the image, a thick one, and nearly flat and nearly vertical lines that most bands
+// never reach. Both kernels; prints the differing pixels and the time of each way. Returns whether all matched.
+bool check() {
+    const int size = 300, threads = 4;
+    std::vector<Line> lines = {{0, 62, 299, 62.000000000001, 200 / 255.0, 1, 2.2},
+                               {62, 0, 62.000000000001, 299, 200 / 255.0, 1, 2.2},
+                               {-50, 10, 350, 290, 1, 1, 0},
+                               {150, -40, 160, 340, 0.5, 1, 0},
+                               {-0.5, 0, -0.5, 299, 1, 1, 2.2},
+                               {0, 299.5, 299, 299.5, 1, 1, 2.2},
+                               {20, 20, 280, 250, 0.8, 5, 0}};
+    for (int i = 0; i < 16; i++) {
+        double angle = (i + 0.5) * M_PI / 8;
+        lines.push_back({150, 150, 150 + 200 * cos(angle), 150 + 200 * sin(angle), (i * 16 + 15) / 255.0, 1, 2.2});
+    }
+    bool matched = true;
+    printf("kernel  differing pixels  sequential s  banded s\n");
+    for (Kernel kernel : {WU_DOUBLE, WU_FIXED}) {
+        std::vector<uchar> sequential(size * size), banded;
+        for (int i = 0; i < size * size; i++)
+            sequential[i] = i % 251;
+        banded = sequential;
+        auto start = std::chrono::steady_clock::now();
+        drawLines(lines, sequential.data(), size, size, 255, kernel, 1);
+        auto middle = std::chrono::steady_clock::now();
+        drawLines(lines, banded.data(), size, size, 255, kernel, threads);
+        auto end = std::chrono::steady_clock::now();
+        int differing = 0;
+        for (int i = 0; i < size * size; i++)
+            differing += sequential[i] != banded[i];
+        matched &= differing == 0;
+        printf("%-6s  %16i  %12.4f  %8.4f\n", kernel == WU_FIXED ? "fixed" : "double", differing,
+               std::chrono::duration<double>(middle - start).count(),
+               std::chrono::duration<double>(end - middle).count());
+    }
+    return matched;
 }
 
 void error(int errCode) {
@@ -231,58 +638,78 @@ void error(int errCode) {
 }
 
 int main(int argc, char **argv) {
-    if (argc < 9) {
+    std::vector<char *> args;
+    const char *batch = nullptr;
+    Kernel kernel = WU_DOUBLE;
+    int threads = std::max((int) std::thread::hardware_concurrency(), 1);
+    for (int i = 0; i < argc; i++) {
+        if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch = argv[++i];
+        else if (!strcmp(argv[i], "--kernel") && i + 1 < argc)
+            kernel = strcmp(argv[++i], "fixed") ? WU_DOUBLE : WU_FIXED;
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--bench")) {
+            benchmark();
+            return 0;
+        } else if (!strcmp(argv[i], "--check"))
+            return check() ? 0 : 1;
+        else
+            args.push_back(argv[i]);
+    }
+    if (batch ? args.size() != OUTPUT + 1 : args.size() < Y_END + 1) {
         error(ARGUMENTS);
         return 1;
     }
-    double gamma;
-    if (argc == 9)
-        gamma = 0;
-    if (argc == 10)
-        gamma = atof(argv[GAMMA]);
-    FILE *input = fopen(argv[INPUT], "rb");
-    if (!input) {
-        error(NO_INPUT);
-        return 1;
-    } else {
-        char format;
-        int width, height, depth;
-        int parsed = fscanf(input, "P%c\n%i %i\n%i\n", &format, &width, &height, &depth);
-        if (parsed != 4 || format != '5') {
-            error(HEADER_PARSING);
-            fclose(input);
+    double gamma = 0;
+    if (!batch && args.size() > GAMMA)
+        gamma = atof(args[GAMMA]);
+    std::vector<Line> lines;
+    if (batch) {
+        FILE *batchFile = strcmp(batch, "-") ? fopen(batch, "r") : stdin;
+        if (!batchFile) {
+            error(NO_BATCH);
             return 1;
         }
-        printf("%c %i %i %i\n", format, width, height, depth);
-        uchar *data;
-        data = new uchar[width * height];
-        unsigned int size = fread(data, 1, width * height, input);
-        if (size != width * height) {
-            error(INPUT_BROKEN);
-            delete[] data;
-            fclose(input);
+        bool parsed = readLines(batchFile, lines);
+        if (batchFile != stdin)
+            fclose(batchFile);
+        if (!parsed) {
+            error(BATCH_BROKEN);
             return 1;
         }
-        drawLine(atof(argv[X_BEGIN]), atof(argv[Y_BEGIN]), atof(argv[X_END]), atof(argv[Y_END]),
-                 atof(argv[BRIGHTNESS]) / 255.0,
-                 data, height, width, atof(argv[THICKNESS]), gamma);
-
-        FILE *output = fopen(argv[OUTPUT], "wb");
-        if (!output) {
-            error(NO_OUTPUT);
-            delete[] data;
-            fclose(input);
-            return 1;
-        } else {
-            int writeBytes = fprintf(output, "P%c\n%i %i\n%i\n", format, width, height, depth);
-            unsigned int writeMembers = fwrite(data, 1, width * height, output);
-            if (writeMembers < width * height || writeBytes == -1) {
-                error(OUTPUT_ERROR);
-            }
-            fclose(input);
-            fclose(output);
-            delete[] data;
-        }
+    } else {
+        Line line = {atof(args[X_BEGIN]), atof(args[Y_BEGIN]), atof(args[X_END]), atof(args[Y_END]),
+                     atof(args[BRIGHTNESS]) / 255.0, (int) atof(args[THICKNESS]), gamma};
+        lines.push_back(line);
+    }
+    Netpbm::Image image;
+    Netpbm::Status status = Netpbm::read(args[INPUT], image);
+    if (status != Netpbm::OK || image.header.channels != 1) {
+        error(status == Netpbm::CANNOT_OPEN ? NO_INPUT : status == Netpbm::TRUNCATED ? INPUT_BROKEN : HEADER_PARSING);
+        return 1;
     }
+    const Netpbm::Header &header = image.header;
+    printf("%c %i %i %i\n", header.format(), header.width, header.height, header.maxval);
+    auto start = std::chrono::steady_clock::now();
+    size_t count = (size_t) header.width * header.height;
+    std::vector<uint16_t> wide;
+    if (header.sampleBytes() == 2) { // 16-bit samples are drawn on natively, scaled to 0..65535
+        wide.resize(count);
+        Netpbm::decode16(image.pixels, wide.data(), count, header.maxval);
+        drawLines(lines, wide.data(), header.height, header.width, 65535, kernel, threads);
+        Netpbm::encode16(wide.data(), image.pixels, count, header.maxval);
+    } else
+        drawLines(lines, image.pixels, header.height, header.width, 255, kernel, threads);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (batch)
+        printf("%zu lines in %.3f s (%.0f lines/s)\n", lines.size(), seconds, lines.size() / seconds);
+
+    status = Netpbm::write(args[OUTPUT], header, image.pixels);
+    if (status == Netpbm::CANNOT_CREATE) {
+        error(NO_OUTPUT);
+        return 1;
+    } else if (status != Netpbm::OK)
+        error(OUTPUT_ERROR);
     return 0;
 }
@@ -4,8 +4,24 @@
 #include <algorithm>
 #include <ctime>
 #include <iostream>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
+#include "../common/Netpbm.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DITHER_SIMD
+#include <immintrin.h>
+#endif
 
 #define ARGS_NUM 7
+#define THRESHOLD_PERIOD 64
+#define BLUE_NOISE_SIZE 64
+#define BLUE_NOISE_MAGIC 0x31544e42 // "BNT1"
 using namespace std;
 
 typedef unsigned char uchar;
@@ -17,9 +33,19 @@ enum ARGS {
 };
 
 enum Dither {
-    NO_DITHER, ORDERED, RANDOM, FLOYD_STEINBERG, JARVIS, SIERRA, ATKINSON, HALFTONE
+    NO_DITHER, ORDERED, RANDOM, FLOYD_STEINBERG, JARVIS, SIERRA, ATKINSON, HALFTONE, BLUE_NOISE
+};
+
+enum Isa {
+    SCALAR, SSE2, AVX2
 };
 
+Isa isa = SCALAR;
+int threads = 1;
+bool gammaLut = true; // --bench turns it off to time the per-pixel pow() of plot()
+const char *blueNoisePath = nullptr; // --tile: blue-noise tile cache, without it the tile is computed every run
+uint32_t seed = 0;
+
 int orderedMatrix[8][8] = {{0,  48, 12, 60, 3,  51, 15, 63},
                            {32, 16, 44, 28, 35, 19, 47, 31},
                            {8,  56, 4,  52, 11, 59, 7,  55},
@@ -34,171 +60,620 @@ int halftoneMatrix[4][4] = {{12, 5,  6, 13},
                             {11, 3,  2, 8},
                             {15, 10, 9, 14}};
 
-void plot(int x, int y, double c, uchar *data, int width, int brightness, double gamma) {
-    data[y * width + x] = pow(double(brightness) / 255, gamma) * c * 255;
+// Pixel is uchar or uint16_t. WHITE is the stored value of white: 8-bit images keep working on 0..255 whatever their
+// maxval, 16-bit ones are scaled to 0..65535 on load. Product holds factor * value for any factor up to WHITE.
+template<class Pixel>
+struct PixelRange {
+    static const int WHITE = (1 << 8 * sizeof(Pixel)) - 1;
+    typedef typename conditional<sizeof(Pixel) == 1, int, long long>::type Product;
+};
+
+template<class Pixel>
+void plot(int x, int y, double c, Pixel *data, int width, int brightness, double gamma) {
+    const int WHITE = PixelRange<Pixel>::WHITE;
+    data[y * width + x] = pow(double(brightness) / WHITE, gamma) * c * WHITE;
 }
 
-void ordered(uchar *data, int bits, int width, int height, double gamma) {
-    int factor = pow(2, bits) - 1;
-    uchar closest;
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            closest = round(factor * data[i * width + j] / 255) * (255 / factor);
-            if ((double) data[i * width + j] / 255 >= (double) orderedMatrix[i % 8][j % 8] / 63)
-                closest = min(255, closest + 255 / factor);
-            plot(j, i, 1, data, width, closest, gamma);
-        }
+// plot() of every brightness, built once per run; the dithering kernels index it instead of calling pow() per pixel
+template<class Pixel>
+vector<Pixel> gammaTable(double gamma) {
+    const int WHITE = PixelRange<Pixel>::WHITE;
+    vector<Pixel> table(WHITE + 1);
+    for (int brightness = 0; brightness <= WHITE; brightness++)
+        plot(brightness, 0, 1, table.data(), WHITE + 1, brightness, gamma);
+    return table;
+}
+
+// Threshold maps in pixel units: a pixel is rounded up when its value is >= the threshold. value / WHITE >=
+// m / maxValue holds exactly when value >= ceil(m * WHITE / maxValue), so the maps reproduce the double comparisons
+// bit for bit. Every row is repeated to THRESHOLD_PERIOD entries, so vector loads at multiples of 32 never wrap.
+template<class Pixel>
+vector<Pixel> thresholdMap(const int *matrix, int size, int maxValue) {
+    const long long WHITE = PixelRange<Pixel>::WHITE;
+    vector<Pixel> map(size * THRESHOLD_PERIOD);
+    for (int i = 0; i < size; i++)
+        for (int j = 0; j < THRESHOLD_PERIOD; j++)
+            map[i * THRESHOLD_PERIOD + j] = (matrix[i * size + j % size] * WHITE + maxValue - 1) / maxValue;
+    return map;
+}
+
+// Output value of every quantization level L of the threshold modes, i.e. plot() of min(WHITE, L * (WHITE / factor)).
+// Returns how many levels are distinct at the top: L = factor + 1 only matters when factor does not divide WHITE.
+template<class Pixel>
+int thresholdLevels(int factor, const vector<Pixel> &table, vector<Pixel> &levels) {
+    const int WHITE = PixelRange<Pixel>::WHITE;
+    levels.resize(factor + 2);
+    for (int level = 0; level < factor + 2; level++)
+        levels[level] = table[min((long long) WHITE, (long long) level * (WHITE / factor))];
+    return levels[factor + 1] == levels[factor] ? factor + 1 : factor + 2;
+}
+
+// thresholds repeat every period columns; period is a multiple of 32 or at least the width
+template<class Pixel>
+void thresholdRow(Pixel *row, int from, int width, const Pixel *thresholds, int period, int factor,
+                  const Pixel *levels, int count) {
+    typedef typename PixelRange<Pixel>::Product Product;
+    for (int j = from; j < width; j++) {
+        int level = (Product) factor * row[j] / PixelRange<Pixel>::WHITE + (row[j] >= thresholds[j % period]);
+        row[j] = levels[min(level, count - 1)];
     }
 }
 
-void halftone(uchar *data, int bits, int width, int height, double gamma) {
-    int factor = pow(2, bits) - 1;
-    uchar closest;
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            closest = round(factor * data[i * width + j] / 255) * (255 / factor);
-            if ((double) data[i * width + j] / 255 >= (double) halftoneMatrix[i % 4][j % 4] / 15)
-                closest = min(255, closest + 255 / factor);
-            plot(j, i, 1, data, width, closest, gamma);
-        }
+// The same quantization with plot() per pixel, kept as the baseline of --bench
+template<class Pixel>
+void thresholdRowPow(Pixel *row, int width, const Pixel *thresholds, int period, int factor, double gamma) {
+    typedef typename PixelRange<Pixel>::Product Product;
+    const int WHITE = PixelRange<Pixel>::WHITE;
+    for (int j = 0; j < width; j++) {
+        int level = (Product) factor * row[j] / WHITE + (row[j] >= thresholds[j % period]);
+        plot(j, 0, 1, row, width, min((Product) WHITE, (Product) level * (WHITE / factor)), gamma);
     }
 }
 
-void random(uchar *data, int bits, int width, int height, double gamma) {
-    srand(std::time(nullptr));
-    int factor = pow(2, bits) - 1;
-    uchar closest;
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            closest = round(factor * data[i * width + j] / 255) * (255 / factor);
-            if (data[i * width + j] >= rand() % 255)
-                closest = min(255, closest + 255 / factor);
-            plot(j, i, 1, data, width, closest, gamma);
+#ifdef DITHER_SIMD
+// factor * value / 255 for 16-bit lanes holding factor * value <= 255 * 255: (x + 1 + (x >> 8)) >> 8 is exact there
+__attribute__((target("sse2")))
+inline __m128i div255Sse2(__m128i x) {
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_srli_epi16(x, 8)), 8);
+}
+
+// 16 pixels per step; returns the first column left for the scalar tail
+__attribute__((target("sse2")))
+int thresholdRowSse2(uchar *row, int width, const uchar *thresholds, int period, int factor, const uchar *levels,
+                     int count) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i scale = _mm_set1_epi16(factor);
+    __m128i one = _mm_set1_epi8(1);
+    __m128i top = _mm_set1_epi8((char) (count - 1));
+    __m128i keys[16], values[16];
+    for (int level = 0; level < 16 && level < count; level++) {
+        keys[level] = _mm_set1_epi8((char) level);
+        values[level] = _mm_set1_epi8((char) levels[level]);
+    }
+    alignas(16) uchar index[16];
+    int j = 0;
+    for (; j + 16 <= width; j += 16) {
+        __m128i value = _mm_loadu_si128((const __m128i *) (row + j));
+        __m128i threshold = _mm_loadu_si128((const __m128i *) (thresholds + j % period));
+        __m128i lo = div255Sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(value, zero), scale));
+        __m128i hi = div255Sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(value, zero), scale));
+        __m128i pass = _mm_cmpeq_epi8(_mm_max_epu8(value, threshold), value);
+        __m128i level = _mm_min_epu8(_mm_adds_epu8(_mm_packus_epi16(lo, hi), _mm_and_si128(pass, one)), top);
+        if (count <= 16) { // select chain, SSE2 has no byte shuffle
+            __m128i out = zero;
+            for (int l = 0; l < count; l++)
+                out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi8(level, keys[l]), values[l]));
+            _mm_storeu_si128((__m128i *) (row + j), out);
+        } else {
+            _mm_store_si128((__m128i *) index, level);
+            for (int k = 0; k < 16; k++)
+                row[j + k] = levels[index[k]];
         }
     }
+    return j;
 }
 
-bool isValid(int y, int x, int height, int width) {
-    return y > 0 && x > 0 && y < height && x < width;
+// factor * value / 65535 for 32-bit lanes holding factor * value <= 255 * 65535, exact there like div255Sse2
+__attribute__((target("sse2")))
+inline __m128i div65535Sse2(__m128i x) {
+    return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(x, _mm_set1_epi32(1)), _mm_srli_epi32(x, 16)), 16);
 }
 
-void floydSteinberg(uchar *data, int bits, int width, int height, double gamma) {
-    double distribution[6] = {0, 0, 7.0 / 16, 3.0 / 16, 5.0 / 16, 1.0 / 16};
-    int factor = pow(2, bits) - 1;
-    double *temp = new double[height * width];
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            temp[i * width + j] = (double) data[i * width + j] / 255;
-        }
+// 8 pixels per step for 16-bit images: the products are put together from mullo and mulhi into 32-bit lanes,
+// the levels are looked up per pixel
+__attribute__((target("sse2")))
+int thresholdRowSse2(uint16_t *row, int width, const uint16_t *thresholds, int period, int factor,
+                     const uint16_t *levels, int count) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i scale = _mm_set1_epi16((short) factor);
+    __m128i top = _mm_set1_epi16((short) (count - 1));
+    alignas(16) uint16_t index[8];
+    int j = 0;
+    for (; j + 8 <= width; j += 8) {
+        __m128i value = _mm_loadu_si128((const __m128i *) (row + j));
+        __m128i threshold = _mm_loadu_si128((const __m128i *) (thresholds + j % period));
+        __m128i low = _mm_mullo_epi16(value, scale), high = _mm_mulhi_epu16(value, scale);
+        __m128i lo = div65535Sse2(_mm_unpacklo_epi16(low, high));
+        __m128i hi = div65535Sse2(_mm_unpackhi_epi16(low, high));
+        // -1 where threshold <= value, the quotients are at most 255 so the signed pack and min are safe
+        __m128i pass = _mm_cmpeq_epi16(_mm_subs_epu16(threshold, value), zero);
+        __m128i level = _mm_min_epi16(_mm_sub_epi16(_mm_packs_epi32(lo, hi), pass), top);
+        _mm_store_si128((__m128i *) index, level);
+        for (int k = 0; k < 8; k++)
+            row[j + k] = levels[index[k]];
     }
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            double oldPixel = temp[i * width + j];
-            double newPixel = round(factor * oldPixel) / factor;
-            temp[i * width + j] = newPixel;
-            double error = oldPixel - newPixel;
-            for (int k = 0; k < 2; k++) {
-                for (int l = -1; l < 2; l++) {
-                    if (isValid(i + k, j + l, height, width))
-                        temp[(i + k) * width + j + l] += error * distribution[k * 3 + l + 1];
-                }
-            }
-            plot(j, i, 1, data, width, temp[i * width + j] * 255, gamma);
+    return j;
+}
+
+__attribute__((target("avx2")))
+inline __m256i div255Avx2(__m256i x) {
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x, _mm256_set1_epi16(1)), _mm256_srli_epi16(x, 8)), 8);
+}
+
+// 32 pixels per step; up to 16 levels are looked up with a byte shuffle
+__attribute__((target("avx2")))
+int thresholdRowAvx2(uchar *row, int width, const uchar *thresholds, int period, int factor, const uchar *levels,
+                     int count) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i scale = _mm256_set1_epi16(factor);
+    __m256i one = _mm256_set1_epi8(1);
+    __m256i top = _mm256_set1_epi8((char) (count - 1));
+    alignas(32) uchar table[32] = {};
+    for (int level = 0; level < 16 && level < count; level++)
+        table[level] = table[level + 16] = levels[level];
+    __m256i lookup = _mm256_load_si256((const __m256i *) table);
+    alignas(32) uchar index[32];
+    int j = 0;
+    for (; j + 32 <= width; j += 32) {
+        __m256i value = _mm256_loadu_si256((const __m256i *) (row + j));
+        __m256i threshold = _mm256_loadu_si256((const __m256i *) (thresholds + j % period));
+        // unpack and pack both work per 128-bit lane, so the pixel order survives the round trip
+        __m256i lo = div255Avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(value, zero), scale));
+        __m256i hi = div255Avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(value, zero), scale));
+        __m256i pass = _mm256_cmpeq_epi8(_mm256_max_epu8(value, threshold), value);
+        __m256i level = _mm256_min_epu8(_mm256_adds_epu8(_mm256_packus_epi16(lo, hi), _mm256_and_si256(pass, one)),
+                                        top);
+        if (count <= 16) {
+            _mm256_storeu_si256((__m256i *) (row + j), _mm256_shuffle_epi8(lookup, level));
+        } else {
+            _mm256_store_si256((__m256i *) index, level);
+            for (int k = 0; k < 32; k++)
+                row[j + k] = levels[index[k]];
         }
     }
-    delete[] temp;
+    return j;
 }
 
-void jarvis(uchar *data, int bits, int width, int height, double gamma) {
-    double distribution[] = {0, 0, 0, 7.0 / 48, 5.0 / 48, 3.0 / 48, 5.0 / 48, 7.0 / 48, 5.0 / 48, 3.0 / 48, 1.0 / 48,
-                             3.0 / 48,
-                             5.0 / 48, 3.0 / 48, 1.0 / 48};
-    int factor = pow(2, bits) - 1;
-    double *temp = new double[height * width];
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            temp[i * width + j] = (double) data[i * width + j] / 255;
-        }
+// 8 pixels per step for 16-bit images in 32-bit lanes. factor * value fits a float exactly when factor <= 255, so
+// multiplying by 1 / 65535 and truncating is off by at most one, and one correction step each way makes it exact.
+__attribute__((target("avx2")))
+int thresholdRowAvx2(uint16_t *row, int width, const uint16_t *thresholds, int period, int factor,
+                     const uint16_t *levels, int count) {
+    int table[258];
+    for (int level = 0; level < count; level++)
+        table[level] = levels[level];
+    __m256 inverse = _mm256_set1_ps(1.0f / 65535);
+    __m256i white = _mm256_set1_epi32(65535);
+    __m256i scale = _mm256_set1_epi32(factor);
+    __m256i one = _mm256_set1_epi32(1);
+    __m256i top = _mm256_set1_epi32(count - 1);
+    int j = 0;
+    for (; j + 8 <= width; j += 8) {
+        __m256i value = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (row + j)));
+        __m256i threshold = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (thresholds + j % period)));
+        __m256i product = _mm256_mullo_epi32(value, scale);
+        __m256i quotient = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(product), inverse));
+        // comparisons give -1 where true: step down where q * 65535 > product, up where (q + 1) * 65535 <= product
+        quotient = _mm256_add_epi32(quotient, _mm256_cmpgt_epi32(_mm256_mullo_epi32(quotient, white), product));
+        __m256i next = _mm256_add_epi32(_mm256_mullo_epi32(quotient, white), white);
+        quotient = _mm256_sub_epi32(quotient, _mm256_cmpgt_epi32(_mm256_add_epi32(product, one), next));
+        // + 1 unless threshold > value
+        __m256i level = _mm256_add_epi32(_mm256_add_epi32(quotient, one), _mm256_cmpgt_epi32(threshold, value));
+        __m256i out = _mm256_i32gather_epi32(table, _mm256_min_epi32(level, top), 4);
+        // packus works per 128-bit lane, the two low quarters hold the 8 results in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(out, out), 0x08);
+        _mm_storeu_si128((__m128i *) (row + j), _mm256_castsi256_si128(packed));
     }
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            double oldPixel = temp[i * width + j];
-            double newPixel = round(factor * oldPixel) / factor;
-            temp[i * width + j] = newPixel;
-            double error = oldPixel - newPixel;
-            for (int k = 0; k < 2; k++) {
-                for (int l = -2; l < 3; l++) {
-                    if (isValid(i + k, j + l, height, width))
-                        temp[(i + k) * width + j + l] += error * distribution[k * 5 + l + 2];
-                }
-            }
-            plot(j, i, 1, data, width, temp[i * width + j] * 255, gamma);
-        }
+    return j;
+}
+#endif
+
+Isa detectIsa() {
+#ifdef DITHER_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SSE2;
+#endif
+    return SCALAR;
+}
+
+// Picks the widest kernel the CPU has for one row of a threshold mode
+void quantizeRow(uchar *row, int width, const uchar *thresholds, int period, int factor, const vector<uchar> &levels,
+                 int count, double gamma) {
+    if (!gammaLut) {
+        thresholdRowPow(row, width, thresholds, period, factor, gamma);
+        return;
     }
-    delete[] temp;
+    int j = 0;
+#ifdef DITHER_SIMD
+    if (isa == AVX2 && factor <= 255)
+        j = thresholdRowAvx2(row, width, thresholds, period, factor, levels.data(), count);
+    else if (isa == SSE2 && factor <= 255)
+        j = thresholdRowSse2(row, width, thresholds, period, factor, levels.data(), count);
+#endif
+    thresholdRow(row, j, width, thresholds, period, factor, levels.data(), count);
 }
 
-void sierra(uchar *data, int bits, int width, int height, double gamma) {
-    double distribution[] = {0, 0, 0, 5.0 / 32, 3.0 / 32, 2.0 / 32, 4.0 / 32, 5.0 / 32, 4.0 / 32, 2.0 / 32, 0, 2.0 / 32,
-                             3.0 / 32, 2.0 / 32, 0};
-    int factor = pow(2, bits) - 1;
-    double *temp = new double[height * width];
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            temp[i * width + j] = (double) data[i * width + j] / 255;
+void quantizeRow(uint16_t *row, int width, const uint16_t *thresholds, int period, int factor,
+                 const vector<uint16_t> &levels, int count, double gamma) {
+    if (!gammaLut) {
+        thresholdRowPow(row, width, thresholds, period, factor, gamma);
+        return;
+    }
+    int j = 0;
+#ifdef DITHER_SIMD
+    if (isa == AVX2 && factor <= 255)
+        j = thresholdRowAvx2(row, width, thresholds, period, factor, levels.data(), count);
+    else if (isa == SSE2 && factor <= 255)
+        j = thresholdRowSse2(row, width, thresholds, period, factor, levels.data(), count);
+#endif
+    thresholdRow(row, j, width, thresholds, period, factor, levels.data(), count);
+}
+
+// lowbias32 integer hash (Wellons): a counter-based generator, the noise of a pixel depends only on the seed and the
+// pixel index, so any split of the image gives the same output
+inline uint32_t lowbias32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+// Thresholds of a threshold mode: a map tiled over the image, or hashed per-pixel noise generated a row at a time
+template<class Pixel>
+struct Thresholds {
+    vector<Pixel> map;
+    bool hashed;
+    uint32_t key;
+
+    // thresholds of row i and their period; scratch holds a hashed row and must be width pixels
+    const Pixel *row(int i, int width, Pixel *scratch, int &period) const {
+        if (hashed) {
+            uint32_t index = (uint32_t) i * width;
+            for (int j = 0; j < width; j++)
+                scratch[j] = lowbias32((index + j) ^ key) % PixelRange<Pixel>::WHITE;
+            period = width;
+            return scratch;
         }
+        period = THRESHOLD_PERIOD;
+        return map.data() + (i % (map.size() / THRESHOLD_PERIOD)) * THRESHOLD_PERIOD;
     }
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            double oldPixel = temp[i * width + j];
-            double newPixel = round(factor * oldPixel) / factor;
-            temp[i * width + j] = newPixel;
-            double error = oldPixel - newPixel;
-            for (int k = 0; k < 2; k++) {
-                for (int l = -2; l < 3; l++) {
-                    if (isValid(i + k, j + l, height, width))
-                        temp[(i + k) * width + j + l] += error * distribution[k * 5 + l + 2];
-                }
+};
+
+// Shared body of the threshold modes. Identical to comparing value / 255.0 against the map entry in double
+// and calling plot() per pixel, but the gamma is looked up per level and the rows go through the SIMD kernels.
+// Rows are independent, so they are split into one range per thread.
+template<class Pixel>
+void thresholdDither(Pixel *data, int bits, int width, int height, double gamma, const Thresholds<Pixel> &thresholds) {
+    int factor = pow(2, bits) - 1;
+    vector<Pixel> levels;
+    int count = thresholdLevels(factor, gammaTable<Pixel>(gamma), levels);
+    int workers = max(1, min(threads, height));
+    auto worker = [&](int first, int last) {
+        vector<Pixel> scratch(width);
+        int period;
+        for (int i = first; i < last; i++) {
+            const Pixel *row = thresholds.row(i, width, scratch.data(), period);
+            quantizeRow(data + (long long) i * width, width, row, period, factor, levels, count, gamma);
+        }
+    };
+    vector<thread> pool;
+    for (int t = 1; t < workers; t++)
+        pool.emplace_back(worker, (long long) height * t / workers, (long long) height * (t + 1) / workers);
+    worker(0, height / workers);
+    for (thread &t : pool)
+        t.join();
+}
+
+template<class Pixel>
+Thresholds<Pixel> ordered() {
+    return {thresholdMap<Pixel>(&orderedMatrix[0][0], 8, 63), false, 0};
+}
+
+template<class Pixel>
+Thresholds<Pixel> halftone() {
+    return {thresholdMap<Pixel>(&halftoneMatrix[0][0], 4, 15), false, 0};
+}
+
+// Void-and-cluster threshold tile (Ulichney): the rank of every cell in a toroidal size x size tile, so that the
+// first n ranked cells form an evenly spread pattern for every n. Energy is a Gaussian of the wrapped distance.
+vector<int> voidAndCluster(int size) {
+    const double sigma = 1.5;
+    int cells = size * size;
+    vector<double> kernel(cells), energy(cells, 0);
+    for (int dy = 0; dy < size; dy++)
+        for (int dx = 0; dx < size; dx++) {
+            int wy = min(dy, size - dy), wx = min(dx, size - dx);
+            kernel[dy * size + dx] = exp(-(wx * wx + wy * wy) / (2 * sigma * sigma));
+        }
+    vector<uchar> pattern(cells, 0);
+    auto toggle = [&](int cell, double sign) {
+        pattern[cell] = sign > 0;
+        int y = cell / size, x = cell % size;
+        for (int i = 0; i < size; i++)
+            for (int j = 0; j < size; j++)
+                energy[i * size + j] += sign * kernel[(i - y + size) % size * size + (j - x + size) % size];
+    };
+    // the set cell with the highest energy, or the empty cell with the lowest one
+    auto extreme = [&](uchar set) {
+        int best = 0;
+        double bestEnergy = set ? -HUGE_VAL : HUGE_VAL;
+        for (int cell = 0; cell < cells; cell++)
+            if (pattern[cell] == set && (set ? energy[cell] > bestEnergy : energy[cell] < bestEnergy)) {
+                best = cell;
+                bestEnergy = energy[cell];
             }
-            plot(j, i, 1, data, width, temp[i * width + j] * 255, gamma);
+        return best;
+    };
+
+    unsigned int seed = 1;
+    int ones = 0;
+    while (ones < cells / 10) {
+        seed = seed * 1103515245 + 12345;
+        int cell = (seed >> 8) % cells;
+        if (!pattern[cell]) {
+            toggle(cell, 1);
+            ones++;
         }
     }
-    delete[] temp;
+    while (true) {
+        int cluster = extreme(1);
+        toggle(cluster, -1);
+        int hole = extreme(0);
+        toggle(hole, 1);
+        if (hole == cluster)
+            break;
+    }
+
+    vector<int> ranks(cells);
+    vector<uchar> prototype = pattern;
+    vector<double> prototypeEnergy = energy;
+    for (int rank = ones - 1; rank >= 0; rank--) {
+        int cluster = extreme(1);
+        toggle(cluster, -1);
+        ranks[cluster] = rank;
+    }
+    pattern = prototype;
+    energy = prototypeEnergy;
+    for (int rank = ones; rank < cells; rank++) {
+        int hole = extreme(0);
+        toggle(hole, 1);
+        ranks[hole] = rank;
+    }
+    return ranks;
+}
+
+// Tile cache: a 4-byte magic, the tile size and the ranks, all little-endian 16-bit after the magic
+bool loadBlueNoise(const char *path, int size, vector<int> &ranks) {
+    int cells = size * size;
+    size_t bytes = 4 + 2 + 2 * (size_t) cells;
+    vector<uint16_t> fields(1 + cells);
+    uint32_t magic = 0;
+    Netpbm::MappedFile file;
+    if (!file.open(path) || file.size() != bytes)
+        return false;
+    memcpy(&magic, file.data(), 4);
+    memcpy(fields.data(), file.data() + 4, bytes - 4);
+    if (magic != BLUE_NOISE_MAGIC || fields[0] != size)
+        return false;
+    ranks.resize(cells);
+    for (int cell = 0; cell < cells; cell++) {
+        if (fields[1 + cell] >= cells)
+            return false;
+        ranks[cell] = fields[1 + cell];
+    }
+    return true;
+}
+
+// The cache file: magic, size, then the ranks as uint16_t
+void saveBlueNoise(const char *path, int size, const vector<int> &ranks) {
+    uint32_t magic = BLUE_NOISE_MAGIC;
+    vector<uint16_t> fields(1, size);
+    fields.insert(fields.end(), ranks.begin(), ranks.end());
+    vector<uchar> bytes(4 + 2 * fields.size());
+    memcpy(bytes.data(), &magic, 4);
+    memcpy(bytes.data() + 4, fields.data(), 2 * fields.size());
+    Netpbm::writeAtomically(path, bytes.data(), bytes.size());
+}
+
+// Threshold modes work pixel by pixel, so blue noise runs through the same SIMD kernels as ORDERED
+template<class Pixel>
+Thresholds<Pixel> blueNoise() {
+    vector<int> ranks;
+    if (!blueNoisePath)
+        ranks = voidAndCluster(BLUE_NOISE_SIZE);
+    else if (!loadBlueNoise(blueNoisePath, BLUE_NOISE_SIZE, ranks)) {
+        ranks = voidAndCluster(BLUE_NOISE_SIZE);
+        saveBlueNoise(blueNoisePath, BLUE_NOISE_SIZE, ranks);
+    }
+    return {thresholdMap<Pixel>(ranks.data(), BLUE_NOISE_SIZE, BLUE_NOISE_SIZE * BLUE_NOISE_SIZE - 1), false, 0};
 }
 
-void atkinson(uchar *data, int bits, int width, int height, double gamma) {
-    double distribution[] = {0, 0, 0.125, 0.125, 0.125, 0.125, 0.125, 0, 0, 0.125, 0, 0};
+// Threshold in 0..WHITE - 1 for every pixel, the counterpart of the former rand() % 255. Rounding up at
+// value >= threshold is the threshold-map rule with a map as wide as the row, so the rows go through the same kernels.
+template<class Pixel>
+Thresholds<Pixel> randomNoise() {
+    return {vector<Pixel>(), true, lowbias32(seed)};
+}
+
+template<class Pixel>
+Thresholds<Pixel> thresholds(int ditherType) {
+    switch (ditherType) {
+        case ORDERED:
+            return ordered<Pixel>();
+        case RANDOM:
+            return randomNoise<Pixel>();
+        case HALFTONE:
+            return halftone<Pixel>();
+        default:
+            return blueNoise<Pixel>();
+    }
+}
+
+// Error diffusion kernels: weights[k * (LEFT + 1 + RIGHT) + l + LEFT] is the share of the error that goes to the
+// pixel k rows below and l columns to the right
+struct FloydSteinbergKernel {
+    static const int ROWS = 2, LEFT = 1, RIGHT = 1;
+    static const double weights[];
+};
+const double FloydSteinbergKernel::weights[] = {0, 0, 7.0 / 16, 3.0 / 16, 5.0 / 16, 1.0 / 16};
+
+struct JarvisKernel {
+    static const int ROWS = 2, LEFT = 2, RIGHT = 2;
+    static const double weights[];
+};
+const double JarvisKernel::weights[] = {0, 0, 0, 7.0 / 48, 5.0 / 48, 3.0 / 48, 5.0 / 48, 7.0 / 48, 5.0 / 48, 3.0 / 48};
+
+struct SierraKernel {
+    static const int ROWS = 2, LEFT = 2, RIGHT = 2;
+    static const double weights[];
+};
+const double SierraKernel::weights[] = {0, 0, 0, 5.0 / 32, 3.0 / 32, 2.0 / 32, 4.0 / 32, 5.0 / 32, 4.0 / 32, 2.0 / 32};
+
+struct AtkinsonKernel {
+    static const int ROWS = 3, LEFT = 1, RIGHT = 2;
+    static const double weights[];
+};
+const double AtkinsonKernel::weights[] = {0, 0, 0.125, 0.125, 0.125, 0.125, 0.125, 0, 0, 0.125, 0, 0};
+
+#define PROGRESS_STEP 64
+
+// Error diffusion over a sliding window of rows instead of a double copy of the whole image, run as a wavefront:
+// row i goes to thread i % threads and may handle column j once row i - 1 has finished column j + LEFT + RIGHT.
+// That lag makes every pixel receive its error contributions in the same order as a plain row-major pass, so the
+// output does not depend on the thread count. A row enters the window (as value / WHITE) right before the first
+// pixel that can push error into it, and the window holds threads + ROWS rows so no row in flight is reused.
+// Targets in row 0 and column 0 never received error and still do not: row 0 writes its own row into a scratch
+// row, and column 0 is always read straight from the image.
+// Rows come from a Rows source: read(i) hands out the pixels of row i when it enters the window, row(i) returns them
+// again and write(i) is called once row i is final. Reads happen in increasing order, from several threads.
+// The accumulated error can push a pixel one level past either end of the range, so the output value of every level
+// from -1 to factor + 1 is looked up in quantized[]; brightnesses outside 0..WHITE still go through plot() to get the
+// same values as before.
+template<class Kernel, class Rows>
+void diffuse(Rows &rows, int bits, int width, int height, double gamma, int workers) {
+    typedef typename Rows::Pixel Pixel;
+    const int ROWS = Kernel::ROWS, LEFT = Kernel::LEFT, SPAN = Kernel::LEFT + 1 + Kernel::RIGHT;
+    const int WHITE = PixelRange<Pixel>::WHITE;
     int factor = pow(2, bits) - 1;
-    double *temp = new double[height * width];
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            temp[i * width + j] = (double) data[i * width + j] / 255;
-        }
+    vector<Pixel> table = gammaTable<Pixel>(gamma);
+    vector<Pixel> quantized(factor + 3);
+    for (int level = -1; level <= factor + 1; level++) {
+        int brightness = (double) level / factor * WHITE;
+        if (brightness >= 0 && brightness <= WHITE)
+            quantized[level + 1] = table[brightness];
+        else
+            plot(level + 1, 0, 1, quantized.data(), factor + 3, brightness, gamma);
     }
-    for (int i = 0; i < height; i++) {
+    int windowRows = workers + ROWS;
+    int stride = width + SPAN - 1; // padding on both sides takes the writes that fall off the row
+    vector<double> window(windowRows * stride);
+    vector<double> scratch(stride);
+    vector<atomic<int>> progress(height);
+    for (int i = 0; i < height; i++)
+        progress[i].store(0, memory_order_relaxed);
+    auto enter = [&](int r) {
+        const Pixel *source = rows.read(r);
+        for (int j = 0; j < width; j++)
+            window[(r % windowRows) * stride + LEFT + j] = (double) source[j] / WHITE;
+    };
+    for (int r = 0; r < ROWS - 1 && r < height; r++)
+        enter(r);
+
+    auto diffuseRow = [&](int i) {
+        if (i + ROWS - 1 < height)
+            enter(i + ROWS - 1);
+        double *targets[ROWS];
+        for (int k = 0; k < ROWS; k++)
+            targets[k] = (i + k == 0 ? scratch.data() : &window[((i + k) % windowRows) * stride]) + LEFT;
+        double *current = &window[(i % windowRows) * stride] + LEFT;
+        Pixel *row = rows.row(i);
+        int ready = i == 0 ? width : 0;
         for (int j = 0; j < width; j++) {
-            double oldPixel = temp[i * width + j];
-            double newPixel = round(factor * oldPixel) / factor;
-            temp[i * width + j] = newPixel;
+            int needed = min(j + LEFT + Kernel::RIGHT + 1, width);
+            while (ready < needed) {
+                ready = progress[i - 1].load(memory_order_acquire);
+                if (ready < needed)
+                    this_thread::yield();
+            }
+            double oldPixel = j == 0 ? (double) row[0] / WHITE : current[j];
+            double level = round(factor * oldPixel);
+            double newPixel = level / factor;
             double error = oldPixel - newPixel;
-            for (int k = 0; k < 3; k++) {
-                for (int l = -1; l < 3; l++) {
-                    if (isValid(i + k, j + l, height, width))
-                        temp[(i + k) * width + j + l] += error * distribution[k * 4 + l + 1];
+            for (int k = 0; k < ROWS; k++) {
+                for (int l = -LEFT; l < SPAN - LEFT; l++) {
+                    double weight = Kernel::weights[k * SPAN + l + LEFT];
+                    if (weight != 0)
+                        targets[k][j + l] += error * weight;
                 }
             }
-            plot(j, i, 1, data, width, temp[i * width + j] * 255, gamma);
+            if (gammaLut && level >= -1 && level <= factor + 1)
+                row[j] = quantized[(int) level + 1];
+            else
+                plot(j, 0, 1, row, width, newPixel * WHITE, gamma);
+            if ((j + 1) % PROGRESS_STEP == 0)
+                progress[i].store(j + 1, memory_order_release);
         }
-    }
-    delete[] temp;
+        progress[i].store(width, memory_order_release);
+        rows.write(i);
+    };
+
+    auto worker = [&](int first) {
+        for (int i = first; i < height; i += workers)
+            diffuseRow(i);
+    };
+    vector<thread> pool;
+    for (int t = 1; t < workers; t++)
+        pool.emplace_back(worker, t);
+    worker(0);
+    for (thread &t : pool)
+        t.join();
 }
 
+// Rows of an image held in memory
+template<class Value>
+struct ImageRows {
+    typedef Value Pixel;
+    Pixel *data;
+    int width;
+
+    Pixel *read(int i) {
+        return row(i);
+    }
+
+    Pixel *row(int i) {
+        return data + (long long) i * width;
+    }
 
-void dither(uchar *data, int gradient, int bits, int width, int height, double gamma, int ditherType) {
+    void write(int) {}
+};
+
+template<class Kernel, class Pixel>
+void diffuse(Pixel *data, int bits, int width, int height, double gamma) {
+    ImageRows<Pixel> rows = {data, width};
+    diffuse<Kernel>(rows, bits, width, height, gamma, max(1, min(threads, height)));
+}
+
+template<class Pixel>
+void dither(Pixel *data, int gradient, int bits, int width, int height, double gamma, int ditherType) {
     if (gradient) {
         for (int i = 0; i < height; i++) {
             for (int j = 0; j < width; j++) {
-                data[i * width + j] = j * 255 / height;
+                data[i * width + j] = (long long) j * PixelRange<Pixel>::WHITE / height;
             }
         }
     }
@@ -206,88 +681,278 @@ void dither(uchar *data, int gradient, int bits, int width, int height, double g
         case NO_DITHER: {
             return;
         }
-        case ORDERED: {
-            ordered(data, bits, width, height, gamma);
+        case ORDERED:
+        case RANDOM:
+        case HALFTONE:
+        case BLUE_NOISE: {
+            thresholdDither(data, bits, width, height, gamma, thresholds<Pixel>(ditherType));
+            break;
+        }
+        case FLOYD_STEINBERG: {
+            diffuse<FloydSteinbergKernel>(data, bits, width, height, gamma);
+            break;
+        }
+        case JARVIS: {
+            diffuse<JarvisKernel>(data, bits, width, height, gamma);
+            break;
+        }
+        case SIERRA: {
+            diffuse<SierraKernel>(data, bits, width, height, gamma);
+            break;
+        }
+        case ATKINSON: {
+            diffuse<AtkinsonKernel>(data, bits, width, height, gamma);
+            break;
+        }
+        default:
             break;
+    }
+}
+
+// Megapixels per second of every mode on a synthetic image, with plot() per pixel and with the gamma tables
+void benchmark() {
+    const int width = 2048, height = 2048, bits = 2, rounds = 3;
+    const double gamma = 2.2;
+    vector<uchar> source(width * height), data(width * height);
+    unsigned int seed = 1;
+    for (int i = 0; i < width * height; i++) {
+        seed = seed * 1103515245 + 12345;
+        source[i] = (i % width * 255 / width + (seed >> 16) % 32) % 256;
+    }
+    const char *names[] = {"none", "ordered", "random", "floyd-steinberg", "jarvis", "sierra", "atkinson",
+                           "halftone", "blue-noise"};
+    printf("mode              pow MP/s   lut MP/s\n");
+    for (int mode = ORDERED; mode <= BLUE_NOISE; mode++) {
+        printf("%-15s", names[mode]);
+        for (bool lut : {false, true}) {
+            gammaLut = lut;
+            double seconds = 0;
+            for (int r = 0; r < rounds; r++) {
+                copy(source.begin(), source.end(), data.begin());
+                auto start = chrono::steady_clock::now();
+                dither(data.data(), 0, bits, width, height, gamma, mode);
+                seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            }
+            printf("  %9.1f", (double) width * height * rounds / seconds / 1e6);
         }
-        case RANDOM: {
-            random(data, bits, width, height, gamma);
+        printf("\n");
+    }
+    gammaLut = true;
+}
+
+// Rows read from the input and written to the output while dithering, with room for count rows at a time.
+// 16-bit rows go through bytes, a row in the big-endian file layout.
+template<class Value>
+struct StreamRows {
+    typedef Value Pixel;
+    FILE *input, *output;
+    Netpbm::Header header;
+    int width, height, gradient, count;
+    vector<Pixel> slots;
+    vector<uchar> bytes;
+    bool readFailed, writeFailed;
+
+    StreamRows(FILE *input, FILE *output, const Netpbm::Header &header, int gradient, int count)
+            : input(input), output(output), header(header), width(header.width), height(header.height),
+              gradient(gradient), count(count), slots((long long) width * count), bytes(header.rowBytes()),
+              readFailed(false), writeFailed(false) {}
+
+    Pixel *read(int i) {
+        Pixel *buffer = row(i);
+        if (Netpbm::readSamples(input, header, bytes.data(), width) != Netpbm::OK) {
+            readFailed = true;
+            fill(bytes.begin(), bytes.end(), 0);
+        }
+        if (sizeof(Pixel) == 1)
+            copy(bytes.begin(), bytes.end(), buffer);
+        else
+            Netpbm::decode16(bytes.data(), (uint16_t *) buffer, width, header.maxval);
+        if (gradient)
+            for (int j = 0; j < width; j++)
+                buffer[j] = (long long) j * PixelRange<Pixel>::WHITE / height;
+        return buffer;
+    }
+
+    Pixel *row(int i) {
+        return &slots[(long long) (i % count) * width];
+    }
+
+    void write(int i) {
+        if (sizeof(Pixel) == 1)
+            copy(row(i), row(i) + width, bytes.begin());
+        else
+            Netpbm::encode16((const uint16_t *) row(i), bytes.data(), width, header.maxval);
+        if (fwrite(bytes.data(), 1, bytes.size(), output) != bytes.size())
+            writeFailed = true;
+    }
+};
+
+// dither() for --stream: every row is written as soon as it is final, so only the rows a mode looks at at once are
+// kept in memory. Error diffusion runs on one thread here, its wavefront would need the whole window of rows in
+// flight. Returns 0 or the error code.
+template<class Pixel>
+int ditherStream(FILE *input, FILE *output, const Netpbm::Header &header, int gradient, int bits, double gamma,
+                 int ditherType) {
+    int width = header.width, height = header.height;
+    StreamRows<Pixel> rows(input, output, header, gradient, 1);
+    switch (ditherType) {
+        case ORDERED:
+        case RANDOM:
+        case HALFTONE:
+        case BLUE_NOISE: {
+            Thresholds<Pixel> source = thresholds<Pixel>(ditherType);
+            int factor = pow(2, bits) - 1;
+            vector<Pixel> levels, scratch(width);
+            int count = thresholdLevels(factor, gammaTable<Pixel>(gamma), levels);
+            int period;
+            for (int i = 0; i < height; i++) {
+                Pixel *row = rows.read(i);
+                const Pixel *thresholds = source.row(i, width, scratch.data(), period);
+                quantizeRow(row, width, thresholds, period, factor, levels, count, gamma);
+                rows.write(i);
+            }
             break;
         }
         case FLOYD_STEINBERG: {
-            floydSteinberg(data, bits, width, height, gamma);
+            rows = StreamRows<Pixel>(input, output, header, gradient, FloydSteinbergKernel::ROWS);
+            diffuse<FloydSteinbergKernel>(rows, bits, width, height, gamma, 1);
             break;
         }
         case JARVIS: {
-            jarvis(data, bits, width, height, gamma);
+            rows = StreamRows<Pixel>(input, output, header, gradient, JarvisKernel::ROWS);
+            diffuse<JarvisKernel>(rows, bits, width, height, gamma, 1);
             break;
         }
         case SIERRA: {
-            sierra(data, bits, width, height, gamma);
+            rows = StreamRows<Pixel>(input, output, header, gradient, SierraKernel::ROWS);
+            diffuse<SierraKernel>(rows, bits, width, height, gamma, 1);
             break;
         }
         case ATKINSON: {
-            atkinson(data, bits, width, height, gamma);
+            rows = StreamRows<Pixel>(input, output, header, gradient, AtkinsonKernel::ROWS);
+            diffuse<AtkinsonKernel>(rows, bits, width, height, gamma, 1);
             break;
         }
-        case HALFTONE: {
-            halftone(data, bits, width, height, gamma);
+        default: {
+            for (int i = 0; i < height; i++) {
+                rows.read(i);
+                rows.write(i);
+            }
             break;
         }
-        default:
-            break;
     }
+    if (rows.readFailed)
+        return INPUT_BROKEN;
+    return rows.writeFailed ? OUTPUT_ERROR : 0;
 }
 
 void error(int errCode) {
     fprintf(stderr, "Error! Error code: %i", errCode);
 }
 
+void usage() {
+    fprintf(stderr, "\nUsage: lab3 input output gradient dithering bits gamma [--stream] [--isa scalar|sse2]"
+                    " [--threads N] [--seed N] [--tile path]\n"
+                    "  --tile path  caches the blue-noise tile of dithering 8 in path, created on the first run;\n"
+                    "               without it nothing is written and the tile is computed every run\n");
+}
+
 int main(int argc, char **argv) {
-    if (argc < ARGS_NUM) {
+    vector<char *> args;
+    bool stream = false;
+    isa = detectIsa();
+    threads = max((int) thread::hardware_concurrency(), 1);
+    seed = time(nullptr);
+    for (int i = 0; i < argc; i++) {
+        if (!strcmp(argv[i], "--isa") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "scalar"))
+                isa = SCALAR;
+            else if (!strcmp(argv[i], "sse2") && isa >= SSE2)
+                isa = SSE2;
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            seed = strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--stream"))
+            stream = true;
+        else if (!strcmp(argv[i], "--tile") && i + 1 < argc)
+            blueNoisePath = argv[++i];
+        else if (!strcmp(argv[i], "--bench")) {
+            benchmark();
+            return 0;
+        } else
+            args.push_back(argv[i]);
+    }
+    if (args.size() < ARGS_NUM) {
         error(ARGUMENTS);
+        usage();
         return 1;
     }
-    FILE *input = fopen(argv[INPUT], "rb");
-    if (!input) {
-        error(NO_INPUT);
-        return 1;
-    } else {
-        char format;
-        int width, height, depth;
-        int parsed = fscanf(input, "P%c\n%i %i\n%i\n", &format, &width, &height, &depth);
-        if (parsed != 4 || format != '5') {
-            error(HEADER_PARSING);
-            fclose(input);
+    if (stream) {
+        // the output is truncated before the input is read, so it must be another file
+        if (Netpbm::sameFile(args[INPUT], args[OUTPUT])) {
+            error(ARGUMENTS);
             return 1;
         }
-        printf("%c %i %i %i\n", format, width, height, depth);
-        uchar *data;
-        data = new uchar[width * height];
-        unsigned int size = fread(data, 1, width * height, input);
-        if (size != width * height) {
-            error(INPUT_BROKEN);
-            delete[] data;
+        FILE *input = fopen(args[INPUT], "rb");
+        if (!input) {
+            error(NO_INPUT);
+            return 1;
+        }
+        Netpbm::Header header;
+        Netpbm::Status status = Netpbm::readHeader(input, header);
+        if (status != Netpbm::OK || header.channels != 1) {
+            error(HEADER_PARSING);
             fclose(input);
             return 1;
         }
-        dither(data, atoi(argv[GRADIENT]), atoi(argv[BITS]), width, height, atof(argv[GAMMA]), atoi(argv[DITHERING]));
-        FILE *output = fopen(argv[OUTPUT], "wb");
+        printf("%c %i %i %i\n", header.format(), header.width, header.height, header.maxval);
+        FILE *output = fopen(args[OUTPUT], "wb");
         if (!output) {
             error(NO_OUTPUT);
-            delete[] data;
             fclose(input);
             return 1;
-        } else {
-            int writeBytes = fprintf(output, "P%c\n%i %i\n%i\n", format, width, height, depth);
-            unsigned int writeMembers = fwrite(data, 1, width * height, output);
-            if (writeMembers < width * height || writeBytes == -1) {
-                error(OUTPUT_ERROR);
-            }
-            fclose(input);
-            fclose(output);
-            delete[] data;
         }
+        int result = OUTPUT_ERROR;
+        if (fputs(Netpbm::formatHeader(header).c_str(), output) != EOF)
+            result = header.sampleBytes() == 2 ?
+                     ditherStream<uint16_t>(input, output, header, atoi(args[GRADIENT]), atoi(args[BITS]),
+                                            atof(args[GAMMA]), atoi(args[DITHERING])) :
+                     ditherStream<uchar>(input, output, header, atoi(args[GRADIENT]), atoi(args[BITS]),
+                                         atof(args[GAMMA]), atoi(args[DITHERING]));
+        fclose(input);
+        if (fclose(output) && !result)
+            result = OUTPUT_ERROR;
+        if (result) {
+            error(result);
+            return result == INPUT_BROKEN;
+        }
+        return 0;
     }
+    Netpbm::Image image;
+    Netpbm::Status status = Netpbm::read(args[INPUT], image);
+    if (status != Netpbm::OK || image.header.channels != 1) {
+        error(status == Netpbm::CANNOT_OPEN ? NO_INPUT : status == Netpbm::TRUNCATED ? INPUT_BROKEN : HEADER_PARSING);
+        return 1;
+    }
+    const Netpbm::Header &header = image.header;
+    printf("%c %i %i %i\n", header.format(), header.width, header.height, header.maxval);
+    size_t count = (size_t) header.width * header.height;
+    if (header.sampleBytes() == 2) { // 16-bit samples are dithered natively, scaled to 0..65535
+        vector<uint16_t> wide(count);
+        Netpbm::decode16(image.pixels, wide.data(), count, header.maxval);
+        dither(wide.data(), atoi(args[GRADIENT]), atoi(args[BITS]), header.width, header.height, atof(args[GAMMA]),
+               atoi(args[DITHERING]));
+        Netpbm::encode16(wide.data(), image.pixels, count, header.maxval);
+    } else
+        dither(image.pixels, atoi(args[GRADIENT]), atoi(args[BITS]), header.width, header.height, atof(args[GAMMA]),
+               atoi(args[DITHERING]));
+    status = Netpbm::write(args[OUTPUT], header, image.pixels);
+    if (status == Netpbm::CANNOT_CREATE) {
+        error(NO_OUTPUT);
+        return 1;
+    } else if (status != Netpbm::OK)
+        error(OUTPUT_ERROR);
     return 0;
 }
@@ -3,6 +3,7 @@
 //
 
 #include "ColorSpace.h"
+#include "Kernels.h"
 
 #include <algorithm>
 #include <cmath>
@@ -19,28 +20,33 @@ namespace ColorSpace  {
     }
 
     /**Rgb definitions*/
-    Rgb::Rgb(uchar r, uchar g, uchar b) {
+    template<class T>
+    Rgb<T>::Rgb(T r, T g, T b) {
         this->r = r;
         this->g = g;
         this->b = b;
     }
 
-    void Rgb::toRgb(struct Rgb *color) const {
+    template<class T>
+    void Rgb<T>::toRgb(Rgb<T> *color) const {
         color->r = r;
         color->g = g;
         color->b = b;
     }
 
-    void Rgb::toCmy(struct Cmy *color) const {
-        color->c = 255 - r;
-        color->m = 255 - g;
-        color->y = 255 - b;
+    template<class T>
+    void Rgb<T>::toCmy(Cmy<T> *color) const {
+        color->c = Range<T>::MAX - r;
+        color->m = Range<T>::MAX - g;
+        color->y = Range<T>::MAX - b;
     }
 
-    void Rgb::toHsv(struct Hsv *color) const {
-        double rAux = r / 255.0;
-        double gAux = g / 255.0;
-        double bAux = b / 255.0;
+    template<class T>
+    void Rgb<T>::toHsv(Hsv<T> *color) const {
+        const double MAX = Range<T>::MAX;
+        double rAux = r / MAX;
+        double gAux = g / MAX;
+        double bAux = b / MAX;
 
         double max = std::max(std::max(rAux, gAux), bAux);
         double min = std::min(std::min(rAux, gAux), bAux);
@@ -52,7 +58,7 @@ namespace ColorSpace  {
         if (sAux == 0) {
             color->h = 0;
             color->s = 0;
-            color->v = vAux * 255;
+            color->v = vAux * MAX;
         }
         else {
             double hAux = 0;
@@ -61,16 +67,18 @@ namespace ColorSpace  {
             else if (bAux == max) hAux = 4 + (rAux - gAux) / delta;
 
             hAux *= 60;
-            color->h = ((int)std::round(hAux + 360) % 360) / 360.0 * 255;
-            color->s = sAux * 255;
-            color->v = vAux * 255;
+            color->h = ((int)std::round(hAux + 360) % 360) / 360.0 * MAX;
+            color->s = sAux * MAX;
+            color->v = vAux * MAX;
         }
     }
 
-    void Rgb::toHsl(struct Hsl *color) const {
-        double rAux = r / 255.0;
-        double gAux = g / 255.0;
-        double bAux = b / 255.0;
+    template<class T>
+    void Rgb<T>::toHsl(Hsl<T> *color) const {
+        const double MAX = Range<T>::MAX;
+        double rAux = r / MAX;
+        double gAux = g / MAX;
+        double bAux = b / MAX;
 
         double max = std::max(std::max(rAux, gAux), bAux);
         double min = std::min(std::min(rAux, gAux), bAux);
@@ -80,7 +88,7 @@ namespace ColorSpace  {
         if (delta == 0) {
             color->h = 0;
             color->s = 0;
-            color->l = lAux * 255;
+            color->l = lAux * MAX;
         }
         else {
             double sAux = delta / (1 - std::abs(2 * lAux  - 1));
@@ -90,81 +98,97 @@ namespace ColorSpace  {
             else if (bAux == max) hAux = 4 + (rAux - gAux) / delta;
 
             hAux *= 60;
-            color->h = ((int)std::round(hAux + 360) % 360) / 360.0 * 255;
-            color->s = sAux * 255;
-            color->l = lAux * 255;
+            color->h = ((int)std::round(hAux + 360) % 360) / 360.0 * MAX;
+            color->s = sAux * MAX;
+            color->l = lAux * MAX;
         }
     }
 
-    void Rgb::toYcbcr601(struct Ycbcr601 *color) const {
-        color->y = 16 + (65.738 * r + 129.057 * g + 25.064 * b) / 256;
-        color->cb = 128 + (-37.945 * r - 74.494 * g + 112.439 * b) / 256;
-        color->cr = 128 + (112.439 * r - 94.154 * g - 18.285 * b) / 256;
+    template<class T>
+    void Rgb<T>::toYcbcr601(Ycbcr601<T> *color) const {
+        const double SCALE = Range<T>::SCALE;
+        color->y = 16 * SCALE + (65.738 * r + 129.057 * g + 25.064 * b) / 256;
+        color->cb = 128 * SCALE + (-37.945 * r - 74.494 * g + 112.439 * b) / 256;
+        color->cr = 128 * SCALE + (112.439 * r - 94.154 * g - 18.285 * b) / 256;
     }
 
-    void Rgb::toYcbcr709(struct Ycbcr709 *color) const {
+    template<class T>
+    void Rgb<T>::toYcbcr709(Ycbcr709<T> *color) const {
         color->y = 0 + 0.299 * r + 0.587 * g + 0.114 * b;
-        color->cb = 128 - 0.168736 * r - 0.331264 * g + 0.5 * b;
-        color->cr = 128 + 0.5 * r - 0.418688 * g - 0.081312 * b;
+        const double SCALE = Range<T>::SCALE;
+        color->cb = 128 * SCALE - 0.168736 * r - 0.331264 * g + 0.5 * b;
+        color->cr = 128 * SCALE + 0.5 * r - 0.418688 * g - 0.081312 * b;
     }
 
-    void linearize(uchar& a, uchar& b, uchar& c) {
-        a = pow(a / 255.0, 1 / gamma) * 255;
-        b = pow(b / 255.0, 1 / gamma) * 255;
-        c = pow(c / 255.0, 1 / gamma) * 255;
+    template<class T>
+    void linearize(T& a, T& b, T& c) {
+        const double MAX = Range<T>::MAX;
+        a = pow(a / MAX, 1 / gamma) * MAX;
+        b = pow(b / MAX, 1 / gamma) * MAX;
+        c = pow(c / MAX, 1 / gamma) * MAX;
     }
 
-    void delinearize(uchar& a, uchar& b, uchar& c) {
-        a = pow(a / 255.0, gamma) * 255;
-        b = pow(b / 255.0, gamma) * 255;
-        c = pow(c / 255.0, gamma) * 255;
+    template<class T>
+    void delinearize(T& a, T& b, T& c) {
+        const double MAX = Range<T>::MAX;
+        a = pow(a / MAX, gamma) * MAX;
+        b = pow(b / MAX, gamma) * MAX;
+        c = pow(c / MAX, gamma) * MAX;
     }
 
-    Rgb::Rgb() {
+    template<class T>
+    Rgb<T>::Rgb() {
         r = 0;
         g = 0;
         b = 0;
     }
 
-    void Rgb::toYcocg(struct Ycocg *color) const {
+    template<class T>
+    void Rgb<T>::toYcocg(Ycocg<T> *color) const {
         color->co = r - b;
-        uchar temp = b + (color->co >> 1);
+        T temp = b + (color->co >> 1);
         color->cg = g - temp;
         color->y = temp + (color->cg >> 1);
     }
 
 
     /**Cmy definitions*/
-    Cmy::Cmy(uchar c, uchar m, uchar y) {
+    template<class T>
+    Cmy<T>::Cmy(T c, T m, T y) {
         this->c = c;
         this->m = m;
         this->y = y;
     }
 
-    void Cmy::toRgb(struct Rgb *color) const {
+    template<class T>
+    void Cmy<T>::toRgb(Rgb<T> *color) const {
         color->r = 1 - c;
         color->g = 1 - m;
         color->b = 1 - y;
     }
 
-    Cmy::Cmy() {
+    template<class T>
+    Cmy<T>::Cmy() {
         c = 0;
         m = 0;
         y = 0;
     }
 
     /**Hsv definitions*/
-    Hsv::Hsv(uchar h, uchar s, uchar v) {
+    template<class T>
+    Hsv<T>::Hsv(T h, T s, T v) {
         this->h = h;
         this->s = s;
         this->v = v;
     }
 
-    void Hsv::toRgb(struct Rgb *color) const {
-        double hex = h / 255.0 * 360.0 / 60.0;
-        double hAux = h / 255.0;
-        double sAux = s / 255.0;
-        double vAux = v / 255.0;
+    template<class T>
+    void Hsv<T>::toRgb(Rgb<T> *color) const {
+        const double MAX = Range<T>::MAX;
+        double hex = h / MAX * 360.0 / 60.0;
+        double hAux = h / MAX;
+        double sAux = s / MAX;
+        double vAux = v / MAX;
 
         int primary = floor(hex);
         double secondary = hex - primary;
@@ -175,62 +199,66 @@ namespace ColorSpace  {
 
         switch (primary) {
             case 0: {
-                color->r = vAux * 255;
-                color->g = c * 255;
-                color->b = a * 255;
+                color->r = vAux * MAX;
+                color->g = c * MAX;
+                color->b = a * MAX;
                 break;
             }
             case 1: {
-                color->r = b * 255;
-                color->g = vAux * 255;
-                color->b = a * 255;
+                color->r = b * MAX;
+                color->g = vAux * MAX;
+                color->b = a * MAX;
                 break;
             }
             case 2: {
-                color->r = a * 255;
-                color->g = vAux * 255;
-                color->b = c * 255;
+                color->r = a * MAX;
+                color->g = vAux * MAX;
+                color->b = c * MAX;
                 break;
             }
             case 3: {
-                color->r = a * 255;
-                color->g = b * 255;
-                color->b = vAux * 255;
+                color->r = a * MAX;
+                color->g = b * MAX;
+                color->b = vAux * MAX;
                 break;
             }
             case 4: {
-                color->r = c * 255;
-                color->g = a * 255;
-                color->b = vAux * 255;
+                color->r = c * MAX;
+                color->g = a * MAX;
+                color->b = vAux * MAX;
                 break;
             }
             case 5: {
-                color->r = vAux * 255;
-                color->g = a * 255;
-                color->b = b * 255;
+                color->r = vAux * MAX;
+                color->g = a * MAX;
+                color->b = b * MAX;
                 break;
             }
             default: break;
         }
     }
 
-    Hsv::Hsv() {
+    template<class T>
+    Hsv<T>::Hsv() {
         h = 0;
         s = 0;
         v = 0;
     }
 
     /**Hsl definitions*/
-    Hsl::Hsl(uchar h, uchar s, uchar l) {
+    template<class T>
+    Hsl<T>::Hsl(T h, T s, T l) {
         this->h = h;
         this->s = s;
         this->l = l;
     }
 
-    void Hsl::toRgb(struct Rgb *color) const {
-        double H = h / 255.0;
-        double S = s / 255.0;
-        double L = l / 255.0;
+    template<class T>
+    void Hsl<T>::toRgb(Rgb<T> *color) const {
+        const double MAX = Range<T>::MAX;
+        double H = h / MAX;
+        double S = s / MAX;
+        double L = l / MAX;
 
         if (s == 0)
             color->r = color->g = color->b = l;
@@ -238,73 +266,330 @@ namespace ColorSpace  {
             double temp1, temp2;
             temp2 = (L < 0.5) ? (L*(1 + S)) : (L + S - (S*L));
             temp1 = 2 * L - temp2;
-            color->r = 255 * Hue_2_RGB(temp1, temp2, H + 1.0 / 3.0);
-            color->g = 255 * Hue_2_RGB(temp1, temp2, H);
-            color->b = 255 * Hue_2_RGB(temp1, temp2, H - 1.0 / 3.0);
+            color->r = MAX * Hue_2_RGB(temp1, temp2, H + 1.0 / 3.0);
+            color->g = MAX * Hue_2_RGB(temp1, temp2, H);
+            color->b = MAX * Hue_2_RGB(temp1, temp2, H - 1.0 / 3.0);
         }
     }
 
-    Hsl::Hsl() {
+    template<class T>
+    Hsl<T>::Hsl() {
         h = 0;
         s = 0;
         l = 0;
     }
 
     /**Ycbcr601 definitions*/
-    Ycbcr601::Ycbcr601(uchar y, uchar cb, uchar cr) {
+    template<class T>
+    Ycbcr601<T>::Ycbcr601(T y, T cb, T cr) {
         this->y = y;
         this->cb = cb;
         this->cr = cr;
     }
 
-    void Ycbcr601::toRgb(struct Rgb *color) const {
-        color->r = std::max((298.082 * y + 408.583 * cr) / 256 - 222.921, 0.0);
-        color->g = std::max((298.082 * y - 100.291 * cb - 208.120 * cr) / 256 + 135.576, 0.0);
-        color->b = std::max((298.082 * y + 516.412 * cb) / 256 - 276.836, 0.0);
+    template<class T>
+    void Ycbcr601<T>::toRgb(Rgb<T> *color) const {
+        const double SCALE = Range<T>::SCALE;
+        color->r = std::max((298.082 * y + 408.583 * cr) / 256 - 222.921 * SCALE, 0.0);
+        color->g = std::max((298.082 * y - 100.291 * cb - 208.120 * cr) / 256 + 135.576 * SCALE, 0.0);
+        color->b = std::max((298.082 * y + 516.412 * cb) / 256 - 276.836 * SCALE, 0.0);
     }
 
-    Ycbcr601::Ycbcr601() {
+    template<class T>
+    Ycbcr601<T>::Ycbcr601() {
         y = 0;
         cb = 0;
         cr = 0;
     }
 
     /**Ycbcr709 definitions*/
-    Ycbcr709::Ycbcr709(uchar y, uchar cb, uchar cr) {
+    template<class T>
+    Ycbcr709<T>::Ycbcr709(T y, T cb, T cr) {
         this->y = y;
         this->cb = cb;
         this->cr = cr;
     }
 
-    void Ycbcr709::toRgb(struct Rgb *color) const {
-        color->r = std::max(y + 1.402 * (cr - 128), 0.0);
-        color->g = std::max(y - 0.34414 * (cb - 128) - 0.71414 * (cr - 128), 0.0);
-        color->b = std::max(y + 1.772 * (cb - 128), 0.0);
+    template<class T>
+    void Ycbcr709<T>::toRgb(Rgb<T> *color) const {
+        const double MIDDLE = 128 * Range<T>::SCALE;
+        color->r = std::max(y + 1.402 * (cr - MIDDLE), 0.0);
+        color->g = std::max(y - 0.34414 * (cb - MIDDLE) - 0.71414 * (cr - MIDDLE), 0.0);
+        color->b = std::max(y + 1.772 * (cb - MIDDLE), 0.0);
     }
 
-    Ycbcr709::Ycbcr709() {
+    template<class T>
+    Ycbcr709<T>::Ycbcr709() {
         y = 0;
         cb = 0;
         cr = 0;
     }
 
-    Ycocg::Ycocg() {
+    template<class T>
+    Ycocg<T>::Ycocg() {
         y = 0;
         co = 0;
         cg = 0;
     }
 
-    Ycocg::Ycocg(uchar y, uchar co, uchar cg) {
+    template<class T>
+    Ycocg<T>::Ycocg(T y, T co, T cg) {
         this->y = y;
         this->co = co;
         this->cg = cg;
     }
 
-    void Ycocg::toRgb(struct Rgb *color) const {
-        uchar temp = y - (cg >> 1);
+    template<class T>
+    void Ycocg<T>::toRgb(Rgb<T> *color) const {
+        T temp = y - (cg >> 1);
         color->g = cg + temp;
         color->b = temp - (co >> 1);
         color->r = co + color->b;
     }
-}
 
+    /**Conversion plans*/
+    template<class T, int From>
+    inline void loadRgb(const T *pixel, Rgb<T> *rgb) {
+        switch (From) {
+            case RGB:
+                *rgb = Rgb<T>(pixel[0], pixel[1], pixel[2]);
+                break;
+            case HSL:
+                Hsl<T>(pixel[0], pixel[1], pixel[2]).toRgb(rgb);
+                break;
+            case HSV:
+                Hsv<T>(pixel[0], pixel[1], pixel[2]).toRgb(rgb);
+                break;
+            case YCbCr601:
+                Ycbcr601<T>(pixel[0], pixel[1], pixel[2]).toRgb(rgb);
+                break;
+            case YCbCr709:
+                Ycbcr709<T>(pixel[0], pixel[1], pixel[2]).toRgb(rgb);
+                break;
+            case YCoCg:
+                Ycocg<T>(pixel[0], pixel[1], pixel[2]).toRgb(rgb);
+                break;
+            case CMY:
+                Cmy<T>(pixel[0], pixel[1], pixel[2]).toRgb(rgb);
+                break;
+            default: break;
+        }
+    }
+
+    template<class T, int To>
+    inline void storeRgb(const Rgb<T> &rgb, T *pixel) {
+        switch (To) {
+            case RGB: {
+                pixel[0] = rgb.r;
+                pixel[1] = rgb.g;
+                pixel[2] = rgb.b;
+                break;
+            }
+            case HSL: {
+                Hsl<T> hsl;
+                rgb.toHsl(&hsl);
+                pixel[0] = hsl.h;
+                pixel[1] = hsl.s;
+                pixel[2] = hsl.l;
+                break;
+            }
+            case HSV: {
+                Hsv<T> hsv;
+                rgb.toHsv(&hsv);
+                pixel[0] = hsv.h;
+                pixel[1] = hsv.s;
+                pixel[2] = hsv.v;
+                break;
+            }
+            case YCbCr601: {
+                Ycbcr601<T> ycbcr601;
+                rgb.toYcbcr601(&ycbcr601);
+                pixel[0] = ycbcr601.y;
+                pixel[1] = ycbcr601.cb;
+                pixel[2] = ycbcr601.cr;
+                break;
+            }
+            case YCbCr709: {
+                Ycbcr709<T> ycbcr709;
+                rgb.toYcbcr709(&ycbcr709);
+                pixel[0] = ycbcr709.y;
+                pixel[1] = ycbcr709.cb;
+                pixel[2] = ycbcr709.cr;
+                break;
+            }
+            case YCoCg: {
+                Ycocg<T> ycocg;
+                rgb.toYcocg(&ycocg);
+                pixel[0] = ycocg.y;
+                pixel[1] = ycocg.co;
+                pixel[2] = ycocg.cg;
+                break;
+            }
+            case CMY: {
+                Cmy<T> cmy;
+                rgb.toCmy(&cmy);
+                pixel[0] = cmy.c;
+                pixel[1] = cmy.m;
+                pixel[2] = cmy.y;
+                break;
+            }
+            default: break;
+        }
+    }
+
+    // From and To are constants here, so the switches above fold away and only the arithmetic is left in the loop
+    template<class T, int From, int To>
+    void convertPixels(Pixels<const T> src, Pixels<T> dst, size_t count, const Options&) {
+        for (size_t i = 0; i < count; i++) {
+            T in[3], out[3];
+            for (int k = 0; k < 3; k++)
+                in[k] = src.planes[k][i * src.step];
+            Rgb<T> rgb;
+            loadRgb<T, From>(in, &rgb);
+            storeRgb<T, To>(rgb, out);
+            for (int k = 0; k < 3; k++)
+                dst.planes[k][i * dst.step] = out[k];
+        }
+    }
+
+    // pixels per chunk of a staged conversion, a multiple of the 16 the kernels take per step
+    const size_t CHUNK = 1024;
+
+    // The bulk kernels of Kernels.h for T pixels, the T() argument picks the 8-bit or the 16-bit ones
+    Kernel toRgbKernelOf(Spaces space, bool fixed, uchar) {
+        return toRgbKernel(space, fixed);
+    }
+
+    Kernel fromRgbKernelOf(Spaces space, bool fixed, uchar) {
+        return fromRgbKernel(space, fixed);
+    }
+
+    WideKernel toRgbKernelOf(Spaces space, bool fixed, uint16_t) {
+        return toRgbWideKernel(space, fixed);
+    }
+
+    WideKernel fromRgbKernelOf(Spaces space, bool fixed, uint16_t) {
+        return fromRgbWideKernel(space, fixed);
+    }
+
+    // Pairs with a bulk kernel of Kernels.h on a side. A pair with Rgb on the other side is the kernel alone, the
+    // others take two steps per chunk through a small interleaved buffer: From to Rgb, then Rgb to To. Which kernels
+    // exist depends on options.fixedPoint, so a pair without any under these options falls back to convertPixels.
+    template<class T, int From, int To>
+    void stagedPixels(Pixels<const T> src, Pixels<T> dst, size_t count, const Options& options) {
+        auto decode = toRgbKernelOf((Spaces) From, options.fixedPoint, T());
+        auto encode = fromRgbKernelOf((Spaces) To, options.fixedPoint, T());
+        if (!decode && !encode) {
+            convertPixels<T, From, To>(src, dst, count, options);
+            return;
+        }
+        if (From == RGB && encode) {
+            encode(src, dst, count, options.isa);
+            return;
+        }
+        if (To == RGB && decode) {
+            decode(src, dst, count, options.isa);
+            return;
+        }
+        T chunk[3 * CHUNK];
+        for (size_t first = 0; first < count; first += CHUNK) {
+            size_t n = std::min(CHUNK, count - first);
+            if (decode)
+                decode(src.at(first), interleaved(chunk), n, options.isa);
+            else
+                convertPixels<T, From, RGB>(src.at(first), interleaved(chunk), n, options);
+            if (encode)
+                encode(interleaved((const T *) chunk), dst.at(first), n, options.isa);
+            else
+                convertPixels<T, RGB, To>(interleaved((const T *) chunk), dst.at(first), n, options);
+        }
+    }
+
+    // Pairs that have a kernel under some options are staged, the others are a single inlined loop
+    template<class T, int From, int To>
+    struct Plan {
+        static Conversion<T> resolve() {
+            if (toRgbKernelOf((Spaces) From, true, T()) || fromRgbKernelOf((Spaces) To, true, T()))
+                return stagedPixels<T, From, To>;
+            return convertPixels<T, From, To>;
+        }
+    };
+
+    template<class T, int From>
+    Conversion<T> conversionTo(Spaces to) {
+        switch (to) {
+            case RGB: return Plan<T, From, RGB>::resolve();
+            case HSL: return Plan<T, From, HSL>::resolve();
+            case HSV: return Plan<T, From, HSV>::resolve();
+            case YCbCr601: return Plan<T, From, YCbCr601>::resolve();
+            case YCbCr709: return Plan<T, From, YCbCr709>::resolve();
+            case YCoCg: return Plan<T, From, YCoCg>::resolve();
+            default: return Plan<T, From, CMY>::resolve();
+        }
+    }
+
+    template<class T>
+    Conversion<T> conversion(Spaces from, Spaces to) {
+        switch (from) {
+            case RGB: return conversionTo<T, RGB>(to);
+            case HSL: return conversionTo<T, HSL>(to);
+            case HSV: return conversionTo<T, HSV>(to);
+            case YCbCr601: return conversionTo<T, YCbCr601>(to);
+            case YCbCr709: return conversionTo<T, YCbCr709>(to);
+            case YCoCg: return conversionTo<T, YCoCg>(to);
+            default: return conversionTo<T, CMY>(to);
+        }
+    }
+
+    /**Bulk conversions*/
+    template<class T>
+    void convert(Spaces from, Spaces to, Pixels<const T> src, Pixels<T> dst, size_t n, const Options& options) {
+        conversion<T>(from, to)(src, dst, n, options);
+    }
+
+    template<class T>
+    void convert(Spaces from, Spaces to, const T* src, T* dst, size_t n, Layout layout, const Options& options) {
+        if (layout == PLANAR)
+            convert(from, to, planar(src, src + n, src + 2 * n), planar(dst, dst + n, dst + 2 * n), n, options);
+        else
+            convert(from, to, interleaved(src), interleaved(dst), n, options);
+    }
+
+    template<class T>
+    void convert(Spaces from, Spaces to, const T* const src[3], T* const dst[3], size_t n, const Options& options) {
+        convert(from, to, planar(src[0], src[1], src[2]), planar(dst[0], dst[1], dst[2]), n, options);
+    }
+
+    template struct Rgb<uchar>;
+    template struct Rgb<uint16_t>;
+    template struct Cmy<uchar>;
+    template struct Cmy<uint16_t>;
+    template struct Hsv<uchar>;
+    template struct Hsv<uint16_t>;
+    template struct Hsl<uchar>;
+    template struct Hsl<uint16_t>;
+    template struct Ycbcr601<uchar>;
+    template struct Ycbcr601<uint16_t>;
+    template struct Ycbcr709<uchar>;
+    template struct Ycbcr709<uint16_t>;
+    template struct Ycocg<uchar>;
+    template struct Ycocg<uint16_t>;
+    template void linearize(uchar& a, uchar& b, uchar& c);
+    template void linearize(uint16_t& a, uint16_t& b, uint16_t& c);
+    template void delinearize(uchar& a, uchar& b, uchar& c);
+    template void delinearize(uint16_t& a, uint16_t& b, uint16_t& c);
+    template Conversion<uchar> conversion(Spaces from, Spaces to);
+    template Conversion<uint16_t> conversion(Spaces from, Spaces to);
+    template void convert(Spaces from, Spaces to, Pixels<const uchar> src, Pixels<uchar> dst, size_t n,
+                          const Options& options);
+    template void convert(Spaces from, Spaces to, Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t n,
+                          const Options& options);
+    template void convert(Spaces from, Spaces to, const uchar* src, uchar* dst, size_t n, Layout layout,
+                          const Options& options);
+    template void convert(Spaces from, Spaces to, const uint16_t* src, uint16_t* dst, size_t n, Layout layout,
+                          const Options& options);
+    template void convert(Spaces from, Spaces to, const uchar* const src[3], uchar* const dst[3], size_t n,
+                          const Options& options);
+    template void convert(Spaces from, Spaces to, const uint16_t* const src[3], uint16_t* const dst[3], size_t n,
+                          const Options& options);
+}
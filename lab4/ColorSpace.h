@@ -5,6 +5,9 @@
 #ifndef LAB5_COLORSPACE_H
 #define LAB5_COLORSPACE_H
 
+#include <cstddef>
+#include <cstdint>
+
 namespace ColorSpace {
     typedef unsigned char uchar;
 
@@ -12,71 +15,162 @@ namespace ColorSpace {
         RGB, HSL, HSV, YCbCr601, YCbCr709, YCoCg, CMY
     };
 
+    // INTERLEAVED: the three components of a pixel are adjacent. PLANAR: three planes of n components.
+    enum Layout {
+        INTERLEAVED, PLANAR
+    };
+
     double Hue_2_RGB(double v1, double v2, double vh);
 
+    // Components are uchar for 8-bit images and uint16_t for 16-bit ones. MAX is full scale and SCALE stretches the
+    // 8-bit offsets (16, 128) to it: 1 for uchar, 256 for uint16_t.
+    template<class T>
+    struct Range {
+        static const int MAX = (1 << 8 * sizeof(T)) - 1;
+        static constexpr double SCALE = (MAX + 1) / 256;
+    };
+
+    template<class T> struct Rgb;
+
+    template<class T>
     struct IColorSpace {
-        virtual void toRgb(struct Rgb* obj) const = 0;
+        virtual void toRgb(Rgb<T>* obj) const = 0;
     };
 
     const double gamma = 2.2;
-    void linearize(uchar& a, uchar& b, uchar& c);
-    void delinearize(uchar& a, uchar& b, uchar& c);
+    template<class T> void linearize(T& a, T& b, T& c);
+    template<class T> void delinearize(T& a, T& b, T& c);
+
+    template<class T> struct Cmy;
+    template<class T> struct Hsv;
+    template<class T> struct Hsl;
+    template<class T> struct Ycbcr601;
+    template<class T> struct Ycbcr709;
+    template<class T> struct Ycocg;
 
-    struct Rgb : public IColorSpace {
-        uchar r, g, b;
+    template<class T>
+    struct Rgb : public IColorSpace<T> {
+        T r, g, b;
         Rgb();
-        Rgb(uchar r, uchar g, uchar b);
-        void toRgb(struct Rgb* color) const override;
-        void toCmy(struct Cmy *color) const;
-        void toHsv(struct Hsv* color) const;
-        void toHsl(struct Hsl* color) const;
-        void toYcbcr601(struct Ycbcr601* color) const;
-        void toYcbcr709(struct Ycbcr709* color) const;
-        void toYcocg(struct Ycocg* color) const;
+        Rgb(T r, T g, T b);
+        void toRgb(Rgb<T>* color) const override;
+        void toCmy(Cmy<T>* color) const;
+        void toHsv(Hsv<T>* color) const;
+        void toHsl(Hsl<T>* color) const;
+        void toYcbcr601(Ycbcr601<T>* color) const;
+        void toYcbcr709(Ycbcr709<T>* color) const;
+        void toYcocg(Ycocg<T>* color) const;
     };
 
-    struct Cmy : public IColorSpace {
-        uchar c, m, y;
+    template<class T>
+    struct Cmy : public IColorSpace<T> {
+        T c, m, y;
         Cmy();
-        Cmy(uchar c, uchar m, uchar y);
-        void toRgb(struct Rgb* color) const override;
+        Cmy(T c, T m, T y);
+        void toRgb(Rgb<T>* color) const override;
     };
 
-    struct Hsv : public IColorSpace {
-        uchar h, s, v;
+    template<class T>
+    struct Hsv : public IColorSpace<T> {
+        T h, s, v;
         Hsv();
-        Hsv(uchar h, uchar s, uchar v);
-        void toRgb(struct Rgb* color) const override;
+        Hsv(T h, T s, T v);
+        void toRgb(Rgb<T>* color) const override;
     };
 
-    struct Hsl : public IColorSpace {
-        uchar h, s, l;
+    template<class T>
+    struct Hsl : public IColorSpace<T> {
+        T h, s, l;
         Hsl();
-        Hsl(uchar h, uchar s, uchar l);
-        void toRgb(struct Rgb* color) const override;
+        Hsl(T h, T s, T l);
+        void toRgb(Rgb<T>* color) const override;
     };
 
-    struct Ycbcr601 : public IColorSpace {
-        uchar y, cb, cr;
+    template<class T>
+    struct Ycbcr601 : public IColorSpace<T> {
+        T y, cb, cr;
         Ycbcr601();
-        Ycbcr601(uchar y, uchar cb, uchar cr);
-        void toRgb(struct Rgb* color) const override;
+        Ycbcr601(T y, T cb, T cr);
+        void toRgb(Rgb<T>* color) const override;
     };
 
-    struct Ycbcr709 : public IColorSpace {
-        uchar y, cb, cr;
+    template<class T>
+    struct Ycbcr709 : public IColorSpace<T> {
+        T y, cb, cr;
         Ycbcr709();
-        Ycbcr709(uchar y, uchar cb, uchar cr);
-        void toRgb(struct Rgb* color) const override;
+        Ycbcr709(T y, T cb, T cr);
+        void toRgb(Rgb<T>* color) const override;
     };
 
-    struct Ycocg : public IColorSpace {
-        uchar y, co, cg;
+    template<class T>
+    struct Ycocg : public IColorSpace<T> {
+        T y, co, cg;
         Ycocg();
-        Ycocg(uchar y, uchar co, uchar cg);
-        void toRgb(struct Rgb* color) const override;
+        Ycocg(T y, T co, T cg);
+        void toRgb(Rgb<T>* color) const override;
+    };
+
+    // Components of a run of pixels: component k of pixel i is planes[k][i * step]. Interleaved pixels have step 3
+    // and planes[k] == planes[0] + k, planar ones step 1.
+    template<class T>
+    struct Pixels {
+        T* planes[3];
+        size_t step;
+
+        // the run from pixel i on
+        Pixels at(size_t i) const {
+            return {{planes[0] + i * step, planes[1] + i * step, planes[2] + i * step}, step};
+        }
     };
 
+    template<class T>
+    Pixels<T> interleaved(T* pixels) {
+        return {{pixels, pixels + 1, pixels + 2}, 3};
+    }
+
+    template<class T>
+    Pixels<T> planar(T* first, T* second, T* third) {
+        return {{first, second, third}, 1};
+    }
+
+    enum Isa {
+        SCALAR, SSSE3, AVX2
+    };
+
+    // Widest instruction set of this CPU that the bulk kernels of Kernels.h have a path for
+    Isa detectIsa();
+
+    // How a bulk conversion runs: the widest instruction set its kernels may use, and whether YCbCr may go through
+    // the approximate fixed-point kernels instead of the double formulas. Every call gets its own, so callers with
+    // different needs do not share any state.
+    struct Options {
+        Isa isa = detectIsa();
+        bool fixedPoint = false;
+    };
+
+    // Converts count pixels of src into dst, which is either src itself or does not overlap it. conversion()
+    // resolves a pair of spaces once, to a loop with both halves of the conversion inlined, or to the bulk kernels
+    // of Kernels.h where a side has one; options then pick the kernels and their instruction set on every call.
+    // Either reads and writes both layouts directly.
+    template<class T>
+    using Conversion = void (*)(Pixels<const T> src, Pixels<T> dst, size_t count, const Options& options);
+
+    template<class T>
+    Conversion<T> conversion(Spaces from, Spaces to);
+
+    // Converts n pixels of src into dst in one pass, with any mix of layouts
+    template<class T>
+    void convert(Spaces from, Spaces to, Pixels<const T> src, Pixels<T> dst, size_t n,
+                 const Options& options = Options());
+    // Planar pixels here are three planes of n components one after another
+    template<class T>
+    void convert(Spaces from, Spaces to, const T* src, T* dst, size_t n, Layout layout = INTERLEAVED,
+                 const Options& options = Options());
+    // Planar pixels whose planes are separate arrays
+    template<class T>
+    void convert(Spaces from, Spaces to, const T* const src[3], T* const dst[3], size_t n,
+                 const Options& options = Options());
+
 }
 
 #endif //LAB5_COLORSPACE_H
@@ -0,0 +1,1002 @@
+#include "Kernels.h"
+
+#include "../common/Netpbm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLORSPACE_SIMD
+#include <immintrin.h>
+#endif
+
+namespace ColorSpace {
+    Isa detectIsa() {
+#ifdef COLORSPACE_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return AVX2;
+        if (__builtin_cpu_supports("ssse3"))
+            return SSSE3;
+#endif
+        return SCALAR;
+    }
+
+    const char *cubeDirectory = nullptr;
+
+    /**Fixed-point linear transforms*/
+    // out[k] = (m[k][0] * a + m[k][1] * b + m[k][2] * c + offset[k]) >> shift, saturated to 0..255.
+    // Every coefficient fits 16 bits, so the vector paths multiply with madd and get the same sums.
+    struct Linear {
+        int m[3][3];
+        int offset[3];
+        int shift;
+    };
+
+    // Coefficients of the double formulas divided by divisor, rounded to shift fractional bits
+    Linear linear(const double m[3][3], const double offset[3], double divisor, int shift) {
+        Linear transform;
+        for (int k = 0; k < 3; k++) {
+            for (int l = 0; l < 3; l++)
+                transform.m[k][l] = (int) std::lround(m[k][l] / divisor * (1 << shift));
+            transform.offset[k] = (int) std::lround(offset[k] * (1 << shift));
+        }
+        transform.shift = shift;
+        return transform;
+    }
+
+    const double toYcbcr601[3][3] = {{65.738,  129.057,  25.064},
+                                     {-37.945, -74.494,  112.439},
+                                     {112.439, -94.154,  -18.285}};
+    const double toYcbcr601Offset[3] = {16, 128, 128};
+    const double fromYcbcr601[3][3] = {{298.082, 0,        408.583},
+                                       {298.082, -100.291, -208.120},
+                                       {298.082, 516.412,  0}};
+    const double fromYcbcr601Offset[3] = {-222.921, 135.576, -276.836};
+    const double toYcbcr709[3][3] = {{0.299,     0.587,     0.114},
+                                     {-0.168736, -0.331264, 0.5},
+                                     {0.5,       -0.418688, -0.081312}};
+    const double toYcbcr709Offset[3] = {0, 128, 128};
+    const double fromYcbcr709[3][3] = {{1, 0,        1.402},
+                                       {1, -0.34414, -0.71414},
+                                       {1, 1.772,    0}};
+    const double fromYcbcr709Offset[3] = {-1.402 * 128, (0.34414 + 0.71414) * 128, -1.772 * 128};
+
+    // 516.412 / 256 needs the shift down to 13 bits to fit, the others keep as many as they can
+    const Linear rgbTo601 = linear(toYcbcr601, toYcbcr601Offset, 256, 15);
+    const Linear ycbcr601To = linear(fromYcbcr601, fromYcbcr601Offset, 256, 13);
+    const Linear rgbTo709 = linear(toYcbcr709, toYcbcr709Offset, 1, 15);
+    const Linear ycbcr709To = linear(fromYcbcr709, fromYcbcr709Offset, 1, 14);
+
+    void linearScalar(const Linear &t, Pixels<const uchar> src, Pixels<uchar> dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            int a = src.planes[0][i * src.step], b = src.planes[1][i * src.step], c = src.planes[2][i * src.step];
+            for (int k = 0; k < 3; k++) {
+                int value = (t.m[k][0] * a + t.m[k][1] * b + t.m[k][2] * c + t.offset[k]) >> t.shift;
+                dst.planes[k][i * dst.step] = std::min(std::max(value, 0), 255);
+            }
+        }
+    }
+
+    // 16-bit YCbCr: the double formulas in single precision, ((m0 * a + m1 * b) + m2 * c) + offset in this order on
+    // every path, truncated and saturated to 0..65535. The offsets are those of the 8-bit formulas scaled by 256.
+    struct WideLinear {
+        float m[3][3];
+        float offset[3];
+    };
+
+    WideLinear wideLinear(const double m[3][3], const double offset[3], double divisor) {
+        WideLinear transform;
+        for (int k = 0; k < 3; k++) {
+            for (int l = 0; l < 3; l++)
+                transform.m[k][l] = (float) (m[k][l] / divisor);
+            transform.offset[k] = (float) (offset[k] * 256);
+        }
+        return transform;
+    }
+
+    const WideLinear rgbTo601Wide = wideLinear(toYcbcr601, toYcbcr601Offset, 256);
+    const WideLinear ycbcr601ToWide = wideLinear(fromYcbcr601, fromYcbcr601Offset, 256);
+    const WideLinear rgbTo709Wide = wideLinear(toYcbcr709, toYcbcr709Offset, 1);
+    const WideLinear ycbcr709ToWide = wideLinear(fromYcbcr709, fromYcbcr709Offset, 1);
+
+    void linearScalar(const WideLinear &t, Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            float a = src.planes[0][i * src.step], b = src.planes[1][i * src.step], c = src.planes[2][i * src.step];
+            for (int k = 0; k < 3; k++) {
+                float value = t.m[k][0] * a + t.m[k][1] * b + t.m[k][2] * c + t.offset[k];
+                dst.planes[k][i * dst.step] = (uint16_t) std::min(std::max(value, 0.0f), 65535.0f);
+            }
+        }
+    }
+
+    // T is uchar or uint16_t, the steps wrap around in T like those of Rgb<T>::toYcocg and Ycocg<T>::toRgb
+    template<class T>
+    void ycocgForwardScalar(Pixels<const T> src, Pixels<T> dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            T r = src.planes[0][i * src.step], g = src.planes[1][i * src.step], b = src.planes[2][i * src.step];
+            T co = r - b;
+            T temp = b + (co >> 1);
+            T cg = g - temp;
+            dst.planes[0][i * dst.step] = temp + (cg >> 1);
+            dst.planes[1][i * dst.step] = co;
+            dst.planes[2][i * dst.step] = cg;
+        }
+    }
+
+    template<class T>
+    void ycocgInverseScalar(Pixels<const T> src, Pixels<T> dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            T y = src.planes[0][i * src.step], co = src.planes[1][i * src.step], cg = src.planes[2][i * src.step];
+            T temp = y - (cg >> 1);
+            T b = temp - (co >> 1);
+            dst.planes[0][i * dst.step] = co + b;
+            dst.planes[1][i * dst.step] = cg + temp;
+            dst.planes[2][i * dst.step] = b;
+        }
+    }
+
+    void ycocgRForwardScalar(Pixels<const uchar> src, uchar *y, int16_t *co, int16_t *cg, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            int r = src.planes[0][i * src.step], g = src.planes[1][i * src.step], b = src.planes[2][i * src.step];
+            int orange = r - b;
+            int temp = b + (orange >> 1);
+            int green = g - temp;
+            y[i] = temp + (green >> 1);
+            co[i] = orange;
+            cg[i] = green;
+        }
+    }
+
+    void ycocgRInverseScalar(const uchar *y, const int16_t *co, const int16_t *cg, Pixels<uchar> dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            int temp = y[i] - (cg[i] >> 1);
+            int b = temp - (co[i] >> 1);
+            dst.planes[0][i * dst.step] = b + co[i];
+            dst.planes[1][i * dst.step] = cg[i] + temp;
+            dst.planes[2][i * dst.step] = b;
+        }
+    }
+
+    /**Integer HSV and HSL*/
+    // What depends on two components at most comes from the double formulas themselves, so it is exact by
+    // construction: saturation and lightness for every max, min pair, the hue byte for every whole degree, the hue
+    // of black, which the double path takes from a NaN, and the lowest level of Hsv::toRgb for every s, v pair.
+    struct HueTables {
+        uchar hue[360];
+        uchar hsvSaturation[256][256], hslSaturation[256][256], hslLightness[256][256];
+        uchar black[3];
+        uchar hsvLowest[256][256];
+
+        HueTables() {
+            for (int degree = 0; degree < 360; degree++)
+                hue[degree] = degree / 360.0 * 255;
+            for (int max = 0; max < 256; max++) {
+                for (int min = 0; min <= max; min++) {
+                    Hsv<uchar> hsv;
+                    Hsl<uchar> hsl;
+                    Rgb<uchar>(max, min, min).toHsv(&hsv);
+                    Rgb<uchar>(max, min, min).toHsl(&hsl);
+                    hsvSaturation[max][min] = hsv.s;
+                    hslSaturation[max][min] = hsl.s;
+                    hslLightness[max][min] = hsl.l;
+                }
+            }
+            for (int s = 0; s < 256; s++) {
+                for (int v = 0; v < 256; v++) {
+                    Rgb<uchar> rgb;
+                    Hsv<uchar>(0, s, v).toRgb(&rgb);
+                    hsvLowest[s][v] = rgb.b;
+                }
+            }
+            Hsv<uchar> hsv;
+            Rgb<uchar>().toHsv(&hsv);
+            black[0] = hsv.h;
+            black[1] = hsv.s;
+            black[2] = hsv.v;
+        }
+    };
+
+    const HueTables &hueTables() {
+        static const HueTables tables;
+        return tables;
+    }
+
+    // Hue byte of a pixel with max - min = delta > 0. The degrees are 360 + 60 * (sextant + difference / delta)
+    // rounded half up, a fraction over 2 * delta; false on a tie.
+    inline bool hueOf(int r, int g, int b, int max, int delta, uchar &hue) {
+        int sextant = r == max ? 0 : g == max ? 2 : 4;
+        int difference = r == max ? g - b : g == max ? b - r : r - g;
+        int denominator = 2 * delta;
+        int numerator = denominator * (360 + 60 * sextant) + 120 * difference + delta;
+        if (numerator % denominator == 0)
+            return false;
+        hue = hueTables().hue[numerator / denominator % 360];
+        return true;
+    }
+
+    // floor(numerator / DENOMINATOR), false when that is exact and not 0: the double path may land just below it
+    template<int DENOMINATOR>
+    inline bool floorOf(int numerator, uchar &value) {
+        int quotient = numerator / DENOMINATOR;
+        value = quotient;
+        return quotient * DENOMINATOR != numerator || numerator == 0;
+    }
+
+    void hsvForward(int r, int g, int b, uchar *out) {
+        const HueTables &tables = hueTables();
+        int max = std::max(std::max(r, g), b), min = std::min(std::min(r, g), b);
+        if (max == 0) {
+            std::copy(tables.black, tables.black + 3, out);
+            return;
+        }
+        out[0] = 0;
+        out[1] = tables.hsvSaturation[max][min];
+        out[2] = max;
+        if (max != min && !hueOf(r, g, b, max, max - min, out[0])) {
+            Hsv<uchar> hsv;
+            Rgb<uchar>(r, g, b).toHsv(&hsv);
+            out[0] = hsv.h;
+        }
+    }
+
+    void hslForward(int r, int g, int b, uchar *out) {
+        const HueTables &tables = hueTables();
+        int max = std::max(std::max(r, g), b), min = std::min(std::min(r, g), b);
+        out[0] = 0;
+        out[1] = tables.hslSaturation[max][min];
+        out[2] = tables.hslLightness[max][min];
+        if (max != min && !hueOf(r, g, b, max, max - min, out[0])) {
+            Hsl<uchar> hsl;
+            Rgb<uchar>(r, g, b).toHsl(&hsl);
+            out[0] = hsl.h;
+        }
+    }
+
+    // The sextant is floor(2h / 85) and the position in it q / 85 with q = 2h % 85, so with s and v over 255 the
+    // two levels besides the lowest are fractions over 255 * 85. Hues 85 and 170 are sextant borders the double path
+    // may put on either side.
+    bool hsvInverseExact(int h, int s, int v, uchar *out) {
+        int sextant = 2 * h / 85, q = 2 * h % 85;
+        if (sextant == 6 || s == 0) {
+            // hue 255 falls through the switch of Hsv::toRgb and leaves black
+            std::fill(out, out + 3, sextant == 6 ? 0 : v);
+            return true;
+        }
+        uchar levels[4] = {hueTables().hsvLowest[s][v], 0, 0, (uchar) v}; // a, b, c, v
+        bool exact = floorOf<85 * 255>((85 * 255 - s * q) * v, levels[1]) &
+                     floorOf<85 * 255>((85 * 255 - s * (85 - q)) * v, levels[2]);
+        // component k of sextant i is levels[order[i][k]]
+        static const uchar order[6][3] = {{3, 2, 0}, {1, 3, 0}, {0, 3, 2}, {0, 1, 3}, {2, 0, 3}, {3, 0, 1}};
+        for (int k = 0; k < 3; k++)
+            out[k] = levels[order[sextant][k]];
+        return exact && h != 85 && h != 170;
+    }
+
+    void hsvInverse(int h, int s, int v, uchar *out) {
+        if (hsvInverseExact(h, s, v, out))
+            return;
+        Rgb<uchar> rgb;
+        Hsv<uchar>(h, s, v).toRgb(&rgb);
+        out[0] = rgb.r;
+        out[1] = rgb.g;
+        out[2] = rgb.b;
+    }
+
+    // Hue_2_RGB with temp1 and temp2 as fractions t1, t2 over 255^2 and vh as t over 765. The pieces meet at the
+    // breakpoints, so a tie there gives the same value on both sides.
+    inline bool hueLevel(int t1, int t2, int t, uchar &level) {
+        if (t < 0) t += 765;
+        if (t > 765) t -= 765;
+        if (6 * t < 765) return floorOf<3 * 255 * 255>(765 * t1 + 6 * (t2 - t1) * t, level);
+        if (2 * t < 765) return floorOf<255>(t2, level);
+        if (3 * t < 2 * 765) return floorOf<3 * 255 * 255>(765 * t1 + 6 * (t2 - t1) * (510 - t), level);
+        return floorOf<255>(t1, level);
+    }
+
+    void hslInverse(int h, int s, int l, uchar *out) {
+        if (s == 0) {
+            std::fill(out, out + 3, l);
+            return;
+        }
+        int t2 = 2 * l < 255 ? l * (255 + s) : 255 * (l + s) - l * s, t1 = 510 * l - t2;
+        if (hueLevel(t1, t2, 3 * h + 255, out[0]) & hueLevel(t1, t2, 3 * h, out[1]) &
+            hueLevel(t1, t2, 3 * h - 255, out[2]))
+            return;
+        Rgb<uchar> rgb;
+        Hsl<uchar>(h, s, l).toRgb(&rgb);
+        out[0] = rgb.r;
+        out[1] = rgb.g;
+        out[2] = rgb.b;
+    }
+
+    template<void (*convertPixel)(int, int, int, uchar *)>
+    void pixelwise(Pixels<const uchar> src, Pixels<uchar> dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            uchar out[3];
+            convertPixel(src.planes[0][i * src.step], src.planes[1][i * src.step], src.planes[2][i * src.step], out);
+            for (int k = 0; k < 3; k++)
+                dst.planes[k][i * dst.step] = out[k];
+        }
+    }
+
+    /**Cubes*/
+    // A cube file is a 4-byte magic and the three result bytes of every input, input (a, b, c) at a << 16 | b << 8 | c
+    const uint32_t CUBE_MAGIC = 0x31425543; // "CUB1"
+    const size_t CUBE_ENTRIES = 1 << 24, CUBE_BYTES = 4 + 3 * CUBE_ENTRIES;
+
+    struct Cube {
+        const char *name;
+        void (*compute)(Pixels<const uchar> src, Pixels<uchar> dst, size_t count);
+        std::once_flag once;
+        const uchar *entries;
+        Netpbm::MappedFile file;
+        std::vector<uchar> built;
+    };
+
+    Cube hsvCube = {"rgb-hsv", pixelwise<hsvForward>, {}, nullptr, {}, {}};
+    Cube hsvInverseCube = {"hsv-rgb", pixelwise<hsvInverse>, {}, nullptr, {}, {}};
+    Cube hslCube = {"rgb-hsl", pixelwise<hslForward>, {}, nullptr, {}, {}};
+    Cube hslInverseCube = {"hsl-rgb", pixelwise<hslInverse>, {}, nullptr, {}, {}};
+
+    // The built cube is used whether or not it could be saved
+    void buildCube(Cube &cube, const std::string &path) {
+        uint32_t magic = CUBE_MAGIC;
+        cube.built.resize(CUBE_BYTES);
+        memcpy(cube.built.data(), &magic, 4);
+        std::vector<uchar> inputs(3 << 16);
+        for (int a = 0; a < 256; a++) {
+            for (int i = 0; i < 1 << 16; i++) {
+                inputs[3 * i] = a;
+                inputs[3 * i + 1] = i >> 8;
+                inputs[3 * i + 2] = i;
+            }
+            cube.compute(interleaved((const uchar *) inputs.data()), interleaved(&cube.built[4 + 3 * (a << 16)]),
+                         1 << 16);
+        }
+        cube.entries = cube.built.data() + 4;
+        Netpbm::writeAtomically(path.c_str(), cube.built.data(), CUBE_BYTES);
+    }
+
+    const uchar *entriesOf(Cube &cube) {
+        std::call_once(cube.once, [&cube] {
+            std::string path = std::string(cubeDirectory) + "/" + cube.name + ".cube";
+            uint32_t magic = 0;
+            if (cube.file.open(path.c_str()) && cube.file.size() == CUBE_BYTES) {
+                memcpy(&magic, cube.file.data(), 4);
+                if (magic == CUBE_MAGIC) {
+                    cube.entries = cube.file.data() + 4;
+                    return;
+                }
+            }
+            cube.file.close();
+            buildCube(cube, path);
+        });
+        return cube.entries;
+    }
+
+    void lookUp(const uchar *entries, Pixels<const uchar> src, Pixels<uchar> dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            size_t index = src.planes[0][i * src.step] << 16 | src.planes[1][i * src.step] << 8 |
+                           src.planes[2][i * src.step];
+            for (int k = 0; k < 3; k++)
+                dst.planes[k][i * dst.step] = entries[3 * index + k];
+        }
+    }
+
+    void cubeOrCompute(Cube &cube, Pixels<const uchar> src, Pixels<uchar> dst, size_t count) {
+        if (cubeDirectory)
+            lookUp(entriesOf(cube), src, dst, count);
+        else
+            cube.compute(src, dst, count);
+    }
+
+#ifdef COLORSPACE_SIMD
+    // pshufb masks between 48 interleaved bytes (3 registers) and 16 bytes per channel: deinterleaveMask[k][r] picks
+    // the bytes of channel k out of register r, interleaveMask[r][k] places channel k into output register r
+    alignas(16) const signed char deinterleaveMask[3][3][16] = {
+            {{0,  3,  6,  9,  12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+             {-1, -1, -1, -1, -1, -1, 2,  5,  8,  11, 14, -1, -1, -1, -1, -1},
+             {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1,  4,  7,  10, 13}},
+            {{1,  4,  7,  10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+             {-1, -1, -1, -1, -1, 0,  3,  6,  9,  12, 15, -1, -1, -1, -1, -1},
+             {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2,  5,  8,  11, 14}},
+            {{2,  5,  8,  11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+             {-1, -1, -1, -1, -1, 1,  4,  7,  10, 13, -1, -1, -1, -1, -1, -1},
+             {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0,  3,  6,  9,  12, 15}}};
+    alignas(16) const signed char interleaveMask[3][3][16] = {
+            {{0,  -1, -1, 1,  -1, -1, 2,  -1, -1, 3,  -1, -1, 4,  -1, -1, 5},
+             {-1, 0,  -1, -1, 1,  -1, -1, 2,  -1, -1, 3,  -1, -1, 4,  -1, -1},
+             {-1, -1, 0,  -1, -1, 1,  -1, -1, 2,  -1, -1, 3,  -1, -1, 4,  -1}},
+            {{-1, -1, 6,  -1, -1, 7,  -1, -1, 8,  -1, -1, 9,  -1, -1, 10, -1},
+             {5,  -1, -1, 6,  -1, -1, 7,  -1, -1, 8,  -1, -1, 9,  -1, -1, 10},
+             {-1, 5,  -1, -1, 6,  -1, -1, 7,  -1, -1, 8,  -1, -1, 9,  -1, -1}},
+            {{-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1},
+             {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1},
+             {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15}}};
+
+    __attribute__((target("ssse3")))
+    inline void deinterleave(const uchar *pixels, __m128i channels[3]) {
+        __m128i in[3];
+        for (int r = 0; r < 3; r++)
+            in[r] = _mm_loadu_si128((const __m128i *) (pixels + 16 * r));
+        for (int k = 0; k < 3; k++) {
+            channels[k] = _mm_setzero_si128();
+            for (int r = 0; r < 3; r++)
+                channels[k] = _mm_or_si128(channels[k], _mm_shuffle_epi8(
+                        in[r], _mm_load_si128((const __m128i *) deinterleaveMask[k][r])));
+        }
+    }
+
+    __attribute__((target("ssse3")))
+    inline void interleave(uchar *pixels, const __m128i channels[3]) {
+        for (int r = 0; r < 3; r++) {
+            __m128i out = _mm_setzero_si128();
+            for (int k = 0; k < 3; k++)
+                out = _mm_or_si128(out, _mm_shuffle_epi8(
+                        channels[k], _mm_load_si128((const __m128i *) interleaveMask[r][k])));
+            _mm_storeu_si128((__m128i *) (pixels + 16 * r), out);
+        }
+    }
+
+    // Channels of pixels i..i + 15, shuffled out of interleaved pixels or loaded straight from the planes
+    __attribute__((target("ssse3")))
+    inline void load(Pixels<const uchar> src, size_t i, __m128i channels[3]) {
+        if (src.step == 3)
+            deinterleave(src.planes[0] + 3 * i, channels);
+        else
+            for (int k = 0; k < 3; k++)
+                channels[k] = _mm_loadu_si128((const __m128i *) (src.planes[k] + i));
+    }
+
+    __attribute__((target("ssse3")))
+    inline void store(Pixels<uchar> dst, size_t i, const __m128i channels[3]) {
+        if (dst.step == 3)
+            interleave(dst.planes[0] + 3 * i, channels);
+        else
+            for (int k = 0; k < 3; k++)
+                _mm_storeu_si128((__m128i *) (dst.planes[k] + i), channels[k]);
+    }
+
+    alignas(16) const signed char deinterleaveMask16[3][3][16] = {
+            {{0,  1,  6,  7,  12, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+             {-1, -1, -1, -1, -1, -1, 2,  3,  8,  9,  14, 15, -1, -1, -1, -1},
+             {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 4,  5,  10, 11}},
+            {{2,  3,  8,  9,  14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+             {-1, -1, -1, -1, -1, -1, 4,  5,  10, 11, -1, -1, -1, -1, -1, -1},
+             {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0,  1,  6,  7,  12, 13}},
+            {{4,  5,  10, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+             {-1, -1, -1, -1, 0,  1,  6,  7,  12, 13, -1, -1, -1, -1, -1, -1},
+             {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2,  3,  8,  9,  14, 15}}};
+    alignas(16) const signed char interleaveMask16[3][3][16] = {
+            {{0,  1,  -1, -1, -1, -1, 2,  3,  -1, -1, -1, -1, 4,  5,  -1, -1},
+             {-1, -1, 0,  1,  -1, -1, -1, -1, 2,  3,  -1, -1, -1, -1, 4,  5},
+             {-1, -1, -1, -1, 0,  1,  -1, -1, -1, -1, 2,  3,  -1, -1, -1, -1}},
+            {{-1, -1, 6,  7,  -1, -1, -1, -1, 8,  9,  -1, -1, -1, -1, 10, 11},
+             {-1, -1, -1, -1, 6,  7,  -1, -1, -1, -1, 8,  9,  -1, -1, -1, -1},
+             {4,  5,  -1, -1, -1, -1, 6,  7,  -1, -1, -1, -1, 8,  9,  -1, -1}},
+            {{-1, -1, -1, -1, 12, 13, -1, -1, -1, -1, 14, 15, -1, -1, -1, -1},
+             {10, 11, -1, -1, -1, -1, 12, 13, -1, -1, -1, -1, 14, 15, -1, -1},
+             {-1, -1, 10, 11, -1, -1, -1, -1, 12, 13, -1, -1, -1, -1, 14, 15}}};
+
+    // 16-bit pixels: 8 of them fill the three registers, deinterleaveMask16 and interleaveMask16 move 2-byte lanes
+    __attribute__((target("ssse3")))
+    inline void load(Pixels<const uint16_t> src, size_t i, __m128i channels[3]) {
+        if (src.step == 3) {
+            __m128i in[3];
+            for (int r = 0; r < 3; r++)
+                in[r] = _mm_loadu_si128((const __m128i *) (src.planes[0] + 3 * i + 8 * r));
+            for (int k = 0; k < 3; k++) {
+                channels[k] = _mm_setzero_si128();
+                for (int r = 0; r < 3; r++)
+                    channels[k] = _mm_or_si128(channels[k], _mm_shuffle_epi8(
+                            in[r], _mm_load_si128((const __m128i *) deinterleaveMask16[k][r])));
+            }
+        } else
+            for (int k = 0; k < 3; k++)
+                channels[k] = _mm_loadu_si128((const __m128i *) (src.planes[k] + i));
+    }
+
+    __attribute__((target("ssse3")))
+    inline void store(Pixels<uint16_t> dst, size_t i, const __m128i channels[3]) {
+        if (dst.step == 3) {
+            for (int r = 0; r < 3; r++) {
+                __m128i out = _mm_setzero_si128();
+                for (int k = 0; k < 3; k++)
+                    out = _mm_or_si128(out, _mm_shuffle_epi8(
+                            channels[k], _mm_load_si128((const __m128i *) interleaveMask16[r][k])));
+                _mm_storeu_si128((__m128i *) (dst.planes[0] + 3 * i + 8 * r), out);
+            }
+        } else
+            for (int k = 0; k < 3; k++)
+                _mm_storeu_si128((__m128i *) (dst.planes[k] + i), channels[k]);
+    }
+
+    // Pairs (m0, m1) and (m2, 0) of output k for madd against the pairs (a, b) and (c, 0) of a pixel
+    inline int pairAb(const Linear &t, int k) {
+        return (int) ((unsigned) t.m[k][1] << 16 | (t.m[k][0] & 0xffff));
+    }
+
+    inline int pairC(const Linear &t, int k) {
+        return t.m[k][2] & 0xffff;
+    }
+
+    __attribute__((target("ssse3")))
+    size_t linearSsse3(const Linear &t, Pixels<const uchar> src, Pixels<uchar> dst, size_t count) {
+        __m128i zero = _mm_setzero_si128(), shift = _mm_cvtsi32_si128(t.shift);
+        __m128i ab[3], c[3], offset[3];
+        for (int k = 0; k < 3; k++) {
+            ab[k] = _mm_set1_epi32(pairAb(t, k));
+            c[k] = _mm_set1_epi32(pairC(t, k));
+            offset[k] = _mm_set1_epi32(t.offset[k]);
+        }
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i in[3], out[3];
+            load(src, i, in);
+            __m128i wide[3][2];
+            for (int k = 0; k < 3; k++) {
+                wide[k][0] = _mm_unpacklo_epi8(in[k], zero);
+                wide[k][1] = _mm_unpackhi_epi8(in[k], zero);
+            }
+            // pixels 0-3, 4-7, 8-11 and 12-15 in 32-bit lanes
+            __m128i pairs[4], thirds[4];
+            for (int h = 0; h < 2; h++) {
+                pairs[2 * h] = _mm_unpacklo_epi16(wide[0][h], wide[1][h]);
+                pairs[2 * h + 1] = _mm_unpackhi_epi16(wide[0][h], wide[1][h]);
+                thirds[2 * h] = _mm_unpacklo_epi16(wide[2][h], zero);
+                thirds[2 * h + 1] = _mm_unpackhi_epi16(wide[2][h], zero);
+            }
+            for (int k = 0; k < 3; k++) {
+                __m128i sums[4];
+                for (int q = 0; q < 4; q++)
+                    sums[q] = _mm_sra_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(pairs[q], ab[k]),
+                                                                        _mm_madd_epi16(thirds[q], c[k])),
+                                                          offset[k]), shift);
+                out[k] = _mm_packus_epi16(_mm_packs_epi32(sums[0], sums[1]), _mm_packs_epi32(sums[2], sums[3]));
+            }
+            store(dst, i, out);
+        }
+        return i;
+    }
+
+    // The same sums on 16 pixels widened to one 256-bit register per channel
+    __attribute__((target("avx2")))
+    size_t linearAvx2(const Linear &t, Pixels<const uchar> src, Pixels<uchar> dst, size_t count) {
+        __m256i zero = _mm256_setzero_si256();
+        __m128i shift = _mm_cvtsi32_si128(t.shift);
+        __m256i ab[3], c[3], offset[3];
+        for (int k = 0; k < 3; k++) {
+            ab[k] = _mm256_set1_epi32(pairAb(t, k));
+            c[k] = _mm256_set1_epi32(pairC(t, k));
+            offset[k] = _mm256_set1_epi32(t.offset[k]);
+        }
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i in[3], out[3];
+            load(src, i, in);
+            __m256i a = _mm256_cvtepu8_epi16(in[0]), b = _mm256_cvtepu8_epi16(in[1]);
+            __m256i third = _mm256_cvtepu8_epi16(in[2]);
+            // unpack and packs both work per 128-bit lane, so the pixel order survives the round trip
+            __m256i pairs[2] = {_mm256_unpacklo_epi16(a, b), _mm256_unpackhi_epi16(a, b)};
+            __m256i thirds[2] = {_mm256_unpacklo_epi16(third, zero), _mm256_unpackhi_epi16(third, zero)};
+            for (int k = 0; k < 3; k++) {
+                __m256i sums[2];
+                for (int q = 0; q < 2; q++)
+                    sums[q] = _mm256_sra_epi32(_mm256_add_epi32(
+                            _mm256_add_epi32(_mm256_madd_epi16(pairs[q], ab[k]), _mm256_madd_epi16(thirds[q], c[k])),
+                            offset[k]), shift);
+                __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(sums[0], sums[1]), zero);
+                out[k] = _mm256_castsi256_si128(_mm256_permute4x64_epi64(bytes, 0x08));
+            }
+            store(dst, i, out);
+        }
+        return i;
+    }
+
+    // 16-bit YCbCr on 8 pixels per step, as two halves of 4 floats. SSSE3 has no unsigned 32-to-16 pack, so the
+    // results are packed around 32768.
+    __attribute__((target("ssse3")))
+    size_t linearSsse3(const WideLinear &t, Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count) {
+        __m128i zero = _mm_setzero_si128(), middle = _mm_set1_epi32(32768), sign = _mm_set1_epi16((short) 0x8000);
+        __m128 low = _mm_setzero_ps(), high = _mm_set1_ps(65535);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i in[3], out[3];
+            load(src, i, in);
+            __m128 values[3][2];
+            for (int l = 0; l < 3; l++) {
+                values[l][0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(in[l], zero));
+                values[l][1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(in[l], zero));
+            }
+            for (int k = 0; k < 3; k++) {
+                __m128i halves[2];
+                for (int h = 0; h < 2; h++) {
+                    __m128 sum = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.m[k][0]), values[0][h]),
+                                            _mm_mul_ps(_mm_set1_ps(t.m[k][1]), values[1][h]));
+                    sum = _mm_add_ps(_mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(t.m[k][2]), values[2][h])),
+                                     _mm_set1_ps(t.offset[k]));
+                    halves[h] = _mm_sub_epi32(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(sum, low), high)), middle);
+                }
+                out[k] = _mm_xor_si128(_mm_packs_epi32(halves[0], halves[1]), sign);
+            }
+            store(dst, i, out);
+        }
+        return i;
+    }
+
+    // The same sums on all 8 pixels in one 256-bit register per channel
+    __attribute__((target("avx2")))
+    size_t linearAvx2(const WideLinear &t, Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count) {
+        __m256 low = _mm256_setzero_ps(), high = _mm256_set1_ps(65535);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i in[3], out[3];
+            load(src, i, in);
+            __m256 values[3];
+            for (int l = 0; l < 3; l++)
+                values[l] = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(in[l]));
+            for (int k = 0; k < 3; k++) {
+                __m256 sum = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.m[k][0]), values[0]),
+                                           _mm256_mul_ps(_mm256_set1_ps(t.m[k][1]), values[1]));
+                sum = _mm256_add_ps(_mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(t.m[k][2]), values[2])),
+                                    _mm256_set1_ps(t.offset[k]));
+                __m256i words = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(sum, low), high));
+                // packus works per 128-bit lane, the two low quarters hold the 8 results in order
+                __m256i packed = _mm256_packus_epi32(words, words);
+                out[k] = _mm256_castsi256_si128(_mm256_permute4x64_epi64(packed, 0x08));
+            }
+            store(dst, i, out);
+        }
+        return i;
+    }
+
+    // x >> 1 of every byte
+    __attribute__((target("ssse3")))
+    inline __m128i halve(__m128i x) {
+        return _mm_and_si128(_mm_srli_epi16(x, 1), _mm_set1_epi8(0x7f));
+    }
+
+    // Byte arithmetic wraps around like the uchar steps of the scalar lifting; the 128-bit path is shared with AVX2,
+    // the shuffles bound it rather than the few byte operations
+    __attribute__((target("ssse3")))
+    size_t ycocgForwardSsse3(Pixels<const uchar> src, Pixels<uchar> dst, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i in[3], out[3];
+            load(src, i, in);
+            __m128i co = _mm_sub_epi8(in[0], in[2]);
+            __m128i temp = _mm_add_epi8(in[2], halve(co));
+            __m128i cg = _mm_sub_epi8(in[1], temp);
+            out[0] = _mm_add_epi8(temp, halve(cg));
+            out[1] = co;
+            out[2] = cg;
+            store(dst, i, out);
+        }
+        return i;
+    }
+
+    __attribute__((target("ssse3")))
+    size_t ycocgInverseSsse3(Pixels<const uchar> src, Pixels<uchar> dst, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i in[3], out[3];
+            load(src, i, in);
+            __m128i temp = _mm_sub_epi8(in[0], halve(in[2]));
+            out[2] = _mm_sub_epi8(temp, halve(in[1]));
+            out[1] = _mm_add_epi8(in[2], temp);
+            out[0] = _mm_add_epi8(in[1], out[2]);
+            store(dst, i, out);
+        }
+        return i;
+    }
+
+    // 16-bit lanes wrap around like the uint16_t steps, 8 pixels per step
+    __attribute__((target("ssse3")))
+    size_t ycocgForwardSsse3(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count) {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i in[3], out[3];
+            load(src, i, in);
+            __m128i co = _mm_sub_epi16(in[0], in[2]);
+            __m128i temp = _mm_add_epi16(in[2], _mm_srli_epi16(co, 1));
+            __m128i cg = _mm_sub_epi16(in[1], temp);
+            out[0] = _mm_add_epi16(temp, _mm_srli_epi16(cg, 1));
+            out[1] = co;
+            out[2] = cg;
+            store(dst, i, out);
+        }
+        return i;
+    }
+
+    __attribute__((target("ssse3")))
+    size_t ycocgInverseSsse3(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count) {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i in[3], out[3];
+            load(src, i, in);
+            __m128i temp = _mm_sub_epi16(in[0], _mm_srli_epi16(in[2], 1));
+            out[2] = _mm_sub_epi16(temp, _mm_srli_epi16(in[1], 1));
+            out[1] = _mm_add_epi16(in[2], temp);
+            out[0] = _mm_add_epi16(in[1], out[2]);
+            store(dst, i, out);
+        }
+        return i;
+    }
+#endif
+
+#ifdef COLORSPACE_SIMD
+    // The YCoCg-R lifting on 16-bit lanes, where the arithmetic shift is the >> of the scalar steps
+    __attribute__((target("ssse3")))
+    size_t ycocgRForwardSsse3(Pixels<const uchar> src, uchar *y, int16_t *co, int16_t *cg, size_t count) {
+        const __m128i zero = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i in[3], luma[2];
+            load(src, i, in);
+            for (int h = 0; h < 2; h++) {
+                __m128i r = h ? _mm_unpackhi_epi8(in[0], zero) : _mm_unpacklo_epi8(in[0], zero);
+                __m128i g = h ? _mm_unpackhi_epi8(in[1], zero) : _mm_unpacklo_epi8(in[1], zero);
+                __m128i b = h ? _mm_unpackhi_epi8(in[2], zero) : _mm_unpacklo_epi8(in[2], zero);
+                __m128i orange = _mm_sub_epi16(r, b);
+                __m128i temp = _mm_add_epi16(b, _mm_srai_epi16(orange, 1));
+                __m128i green = _mm_sub_epi16(g, temp);
+                luma[h] = _mm_add_epi16(temp, _mm_srai_epi16(green, 1));
+                _mm_storeu_si128((__m128i *) (co + i + 8 * h), orange);
+                _mm_storeu_si128((__m128i *) (cg + i + 8 * h), green);
+            }
+            _mm_storeu_si128((__m128i *) (y + i), _mm_packus_epi16(luma[0], luma[1]));
+        }
+        return i;
+    }
+
+    __attribute__((target("ssse3")))
+    size_t ycocgRInverseSsse3(const uchar *y, const int16_t *co, const int16_t *cg, Pixels<uchar> dst,
+                              size_t count) {
+        const __m128i zero = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i luma = _mm_loadu_si128((const __m128i *) (y + i)), out[3][2];
+            for (int h = 0; h < 2; h++) {
+                __m128i orange = _mm_loadu_si128((const __m128i *) (co + i + 8 * h));
+                __m128i green = _mm_loadu_si128((const __m128i *) (cg + i + 8 * h));
+                __m128i temp = _mm_sub_epi16(h ? _mm_unpackhi_epi8(luma, zero) : _mm_unpacklo_epi8(luma, zero),
+                                             _mm_srai_epi16(green, 1));
+                out[2][h] = _mm_sub_epi16(temp, _mm_srai_epi16(orange, 1));
+                out[1][h] = _mm_add_epi16(green, temp);
+                out[0][h] = _mm_add_epi16(out[2][h], orange);
+            }
+            __m128i channels[3];
+            for (int k = 0; k < 3; k++)
+                channels[k] = _mm_packus_epi16(out[k][0], out[k][1]);
+            store(dst, i, channels);
+        }
+        return i;
+    }
+
+    // 16 lanes in one register; packus works per 128-bit lane, the permute puts the two halves of bytes together
+    __attribute__((target("avx2")))
+    inline __m128i packBytes(__m256i x) {
+        return _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(x, x), 0x08));
+    }
+
+    __attribute__((target("avx2")))
+    size_t ycocgRForwardAvx2(Pixels<const uchar> src, uchar *y, int16_t *co, int16_t *cg, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i in[3];
+            load(src, i, in);
+            __m256i r = _mm256_cvtepu8_epi16(in[0]), g = _mm256_cvtepu8_epi16(in[1]), b = _mm256_cvtepu8_epi16(in[2]);
+            __m256i orange = _mm256_sub_epi16(r, b);
+            __m256i temp = _mm256_add_epi16(b, _mm256_srai_epi16(orange, 1));
+            __m256i green = _mm256_sub_epi16(g, temp);
+            _mm_storeu_si128((__m128i *) (y + i), packBytes(_mm256_add_epi16(temp, _mm256_srai_epi16(green, 1))));
+            _mm256_storeu_si256((__m256i *) (co + i), orange);
+            _mm256_storeu_si256((__m256i *) (cg + i), green);
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2")))
+    size_t ycocgRInverseAvx2(const uchar *y, const int16_t *co, const int16_t *cg, Pixels<uchar> dst, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m256i orange = _mm256_loadu_si256((const __m256i *) (co + i));
+            __m256i green = _mm256_loadu_si256((const __m256i *) (cg + i));
+            __m256i temp = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (y + i))),
+                                            _mm256_srai_epi16(green, 1));
+            __m256i b = _mm256_sub_epi16(temp, _mm256_srai_epi16(orange, 1));
+            __m128i out[3] = {packBytes(_mm256_add_epi16(b, orange)), packBytes(_mm256_add_epi16(green, temp)),
+                              packBytes(b)};
+            store(dst, i, out);
+        }
+        return i;
+    }
+#endif
+
+    void linear(const Linear &t, Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa) {
+        size_t i = 0;
+#ifdef COLORSPACE_SIMD
+        if (isa == AVX2)
+            i = linearAvx2(t, src, dst, count);
+        else if (isa == SSSE3)
+            i = linearSsse3(t, src, dst, count);
+#endif
+        linearScalar(t, src.at(i), dst.at(i), count - i);
+    }
+
+    void linear(const WideLinear &t, Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa) {
+        size_t i = 0;
+#ifdef COLORSPACE_SIMD
+        if (isa == AVX2)
+            i = linearAvx2(t, src, dst, count);
+        else if (isa == SSSE3)
+            i = linearSsse3(t, src, dst, count);
+#endif
+        linearScalar(t, src.at(i), dst.at(i), count - i);
+    }
+
+    /**Kernels*/
+    void rgbToYcocg(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa) {
+        size_t i = 0;
+#ifdef COLORSPACE_SIMD
+        if (isa != SCALAR)
+            i = ycocgForwardSsse3(src, dst, count);
+#endif
+        ycocgForwardScalar(src.at(i), dst.at(i), count - i);
+    }
+
+    void ycocgToRgb(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa) {
+        size_t i = 0;
+#ifdef COLORSPACE_SIMD
+        if (isa != SCALAR)
+            i = ycocgInverseSsse3(src, dst, count);
+#endif
+        ycocgInverseScalar(src.at(i), dst.at(i), count - i);
+    }
+
+    void rgbToYcocgR(Pixels<const uchar> src, uchar *y, int16_t *co, int16_t *cg, size_t count, Isa isa) {
+        size_t i = 0;
+#ifdef COLORSPACE_SIMD
+        if (isa == AVX2)
+            i = ycocgRForwardAvx2(src, y, co, cg, count);
+        else if (isa == SSSE3)
+            i = ycocgRForwardSsse3(src, y, co, cg, count);
+#endif
+        ycocgRForwardScalar(src.at(i), y + i, co + i, cg + i, count - i);
+    }
+
+    void ycocgRToRgb(const uchar *y, const int16_t *co, const int16_t *cg, Pixels<uchar> dst, size_t count, Isa isa) {
+        size_t i = 0;
+#ifdef COLORSPACE_SIMD
+        if (isa == AVX2)
+            i = ycocgRInverseAvx2(y, co, cg, dst, count);
+        else if (isa == SSSE3)
+            i = ycocgRInverseSsse3(y, co, cg, dst, count);
+#endif
+        ycocgRInverseScalar(y + i, co + i, cg + i, dst.at(i), count - i);
+    }
+
+    void rgbToYcbcr601(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa) {
+        linear(rgbTo601, src, dst, count, isa);
+    }
+
+    void ycbcr601ToRgb(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa) {
+        linear(ycbcr601To, src, dst, count, isa);
+    }
+
+    void rgbToYcbcr709(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa) {
+        linear(rgbTo709, src, dst, count, isa);
+    }
+
+    void ycbcr709ToRgb(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa) {
+        linear(ycbcr709To, src, dst, count, isa);
+    }
+
+    void rgbToYcocg(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa) {
+        size_t i = 0;
+#ifdef COLORSPACE_SIMD
+        if (isa != SCALAR)
+            i = ycocgForwardSsse3(src, dst, count);
+#endif
+        ycocgForwardScalar(src.at(i), dst.at(i), count - i);
+    }
+
+    void ycocgToRgb(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa) {
+        size_t i = 0;
+#ifdef COLORSPACE_SIMD
+        if (isa != SCALAR)
+            i = ycocgInverseSsse3(src, dst, count);
+#endif
+        ycocgInverseScalar(src.at(i), dst.at(i), count - i);
+    }
+
+    void rgbToYcbcr601(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa) {
+        linear(rgbTo601Wide, src, dst, count, isa);
+    }
+
+    void ycbcr601ToRgb(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa) {
+        linear(ycbcr601ToWide, src, dst, count, isa);
+    }
+
+    void rgbToYcbcr709(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa) {
+        linear(rgbTo709Wide, src, dst, count, isa);
+    }
+
+    void ycbcr709ToRgb(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa) {
+        linear(ycbcr709ToWide, src, dst, count, isa);
+    }
+
+    void rgbToHsv(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa) {
+        cubeOrCompute(hsvCube, src, dst, count);
+    }
+
+    void hsvToRgb(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa) {
+        cubeOrCompute(hsvInverseCube, src, dst, count);
+    }
+
+    void rgbToHsl(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa) {
+        cubeOrCompute(hslCube, src, dst, count);
+    }
+
+    void hslToRgb(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa) {
+        cubeOrCompute(hslInverseCube, src, dst, count);
+    }
+
+    Kernel fromRgbKernel(Spaces space, bool fixed) {
+        // the YCbCr kernels are approximate
+        if (!fixed && (space == YCbCr601 || space == YCbCr709))
+            return nullptr;
+        switch (space) {
+            case YCoCg: return rgbToYcocg;
+            case HSV: return rgbToHsv;
+            case HSL: return rgbToHsl;
+            case YCbCr601: return rgbToYcbcr601;
+            case YCbCr709: return rgbToYcbcr709;
+            default: return nullptr;
+        }
+    }
+
+    Kernel toRgbKernel(Spaces space, bool fixed) {
+        // the YCbCr kernels are approximate
+        if (!fixed && (space == YCbCr601 || space == YCbCr709))
+            return nullptr;
+        switch (space) {
+            case YCoCg: return ycocgToRgb;
+            case HSV: return hsvToRgb;
+            case HSL: return hslToRgb;
+            case YCbCr601: return ycbcr601ToRgb;
+            case YCbCr709: return ycbcr709ToRgb;
+            default: return nullptr;
+        }
+    }
+
+    WideKernel fromRgbWideKernel(Spaces space, bool fixed) {
+        // the YCbCr kernels are approximate
+        if (!fixed && (space == YCbCr601 || space == YCbCr709))
+            return nullptr;
+        switch (space) {
+            case YCoCg: return rgbToYcocg;
+            case YCbCr601: return rgbToYcbcr601;
+            case YCbCr709: return rgbToYcbcr709;
+            default: return nullptr;
+        }
+    }
+
+    WideKernel toRgbWideKernel(Spaces space, bool fixed) {
+        // the YCbCr kernels are approximate
+        if (!fixed && (space == YCbCr601 || space == YCbCr709))
+            return nullptr;
+        switch (space) {
+            case YCoCg: return ycocgToRgb;
+            case YCbCr601: return ycbcr601ToRgb;
+            case YCbCr709: return ycbcr709ToRgb;
+            default: return nullptr;
+        }
+    }
+}
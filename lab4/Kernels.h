@@ -0,0 +1,62 @@
+#ifndef LAB4_KERNELS_H
+#define LAB4_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ColorSpace.h"
+
+namespace ColorSpace {
+    // Bulk conversions of count 8-bit pixels from src into dst, 16 pixels per vector step. Both are interleaved or
+    // planar; dst is src itself or does not overlap it. SCALAR runs the reference every vector path has to match
+    // exactly; it also handles the tail.
+    typedef void (*Kernel)(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa);
+
+    // The YCoCg lifting is exact, the same integer steps as Rgb::toYcocg and Ycocg::toRgb
+    void rgbToYcocg(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa);
+    void ycocgToRgb(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa);
+    // Fixed-point YCbCr: the double formulas with the coefficients rounded to 13-15 fractional bits. Results are
+    // saturated to 0..255 where the double path wraps around.
+    void rgbToYcbcr601(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa);
+    void ycbcr601ToRgb(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa);
+    void rgbToYcbcr709(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa);
+    void ycbcr709ToRgb(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa);
+    // Lossless YCoCg-R: y in 0..255 and co, cg in -255..255, a bit wider than a byte, so the chroma goes to int16_t
+    // planes. ycocgRToRgb gives back exactly the pixels rgbToYcocgR got. The YCoCg space keeps the byte steps of
+    // Rgb::toYcocg, which wrap co and cg around.
+    void rgbToYcocgR(Pixels<const uchar> src, uchar *y, int16_t *co, int16_t *cg, size_t count, Isa isa);
+    void ycocgRToRgb(const uchar *y, const int16_t *co, const int16_t *cg, Pixels<uchar> dst, size_t count, Isa isa);
+    // Integer HSV and HSL, exact: the results of the double formulas on every input. Hue ties and results that land
+    // right on an integer, where the double path may round either way, are left to the double formulas; that is a
+    // few percent of the inputs. No vector paths, isa is ignored.
+    void rgbToHsv(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa);
+    void hsvToRgb(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa);
+    void rgbToHsl(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa);
+    void hslToRgb(Pixels<const uchar> src, Pixels<uchar> dst, size_t count, Isa isa);
+
+    // Directory of the cubes the HSV and HSL kernels look every pixel up in instead, nullptr to compute them. A cube
+    // holds the 2^24 results of one kernel; it is built on first use, saved there and memory-mapped by later runs.
+    extern const char *cubeDirectory;
+
+    // Kernel between space and Rgb, nullptr when there is none; fixed admits the approximate ones
+    Kernel fromRgbKernel(Spaces space, bool fixed);
+    Kernel toRgbKernel(Spaces space, bool fixed);
+
+    // 16-bit counterparts, 8 pixels per vector step. YCoCg is exact, the uint16_t steps of Rgb<uint16_t>::toYcocg.
+    // YCbCr evaluates the double formulas in single precision, so results next to an integer may truncate the other
+    // way, and saturates to 0..65535 where the double path wraps around. HSV and HSL keep the double formulas: their
+    // exact kernels and cubes are built on 8-bit inputs.
+    typedef void (*WideKernel)(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa);
+
+    void rgbToYcocg(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa);
+    void ycocgToRgb(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa);
+    void rgbToYcbcr601(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa);
+    void ycbcr601ToRgb(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa);
+    void rgbToYcbcr709(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa);
+    void ycbcr709ToRgb(Pixels<const uint16_t> src, Pixels<uint16_t> dst, size_t count, Isa isa);
+
+    WideKernel fromRgbWideKernel(Spaces space, bool fixed);
+    WideKernel toRgbWideKernel(Spaces space, bool fixed);
+}
+
+#endif //LAB4_KERNELS_H
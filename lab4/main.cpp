@@ -1,6 +1,19 @@
 #include <iostream>
 #include "ColorSpace.h"
+#include "Kernels.h"
+#include "../common/Netpbm.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include <vector>
 
 typedef unsigned char uchar;
@@ -9,196 +22,843 @@ typedef unsigned int uint;
 enum Errors {
     ARGUMENTS = 1, NO_INPUT, HEADER_PARSING, INPUT_BROKEN, NO_OUTPUT, OUTPUT_ERROR
 };
-std::vector<FILE*> input;
-std::vector<FILE*> output;
-std::vector<uchar*> inputData;
-std::vector<uchar*> outputData;
-uchar* picture;
+int threads = 1;
+const int BLOCK_ROWS = 16; // rows a thread converts at a time; even, so blocks of 4:2:0 images keep whole chroma rows
+const int FRAMES = 3;      // frames in flight in batch mode: one being read, one converted, one written
+int stripRows = 0;         // -r: rows per strip when streaming, 0 to map whole images
+int chromaX = 1, chromaY = 1; // -u: subsampled chroma planes keep a sample per chromaX by chromaY pixels
+ColorSpace::Options options;  // -s and -k: instruction set and precision of every conversion of the run
 
 void error(int errCode) {
     fprintf(stderr, "Error! Error code: %i", errCode);
 }
 
-void closeFiles() {
-    for (int i = 0; i < input.size(); i++) {
-        if (input[i])
-            fclose(input[i]);
+// Input paths and output paths of one image, 1 or 3 of each
+struct Job {
+    std::vector<std::string> inputPaths;
+    std::vector<std::string> outputPaths;
+};
+
+// One image on its way through the tool. In batch mode the same few frames go round from job to job, so their
+// buffers are allocated once.
+struct Frame {
+    const Job* job = nullptr;
+    std::vector<Netpbm::Image> images = std::vector<Netpbm::Image>(3);
+    Netpbm::Header header;                  // of the outputs
+    std::vector<uchar*> inputData;
+    std::vector<uchar*> outputData;         // the inputs themselves when the layouts match, converted in place
+    std::vector<std::vector<uchar>> inputs; // strips read from the input streams
+    std::vector<std::vector<uchar>> outputs;
+    int status = 0;                         // Errors code of the stage that failed, 0 while all went well
+};
+
+// Threads kept for the whole run. run() splits a task into blocks that the threads, the calling one included, take
+// in turn, and returns once every block is done.
+class Workers {
+public:
+    explicit Workers(int count) {
+        for (int i = 1; i < count; i++)
+            pool.emplace_back(&Workers::loop, this);
+    }
+
+    ~Workers() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &thread : pool)
+            thread.join();
+    }
+
+    void run(int blocks, const std::function<void(int)>& task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->task = &task;
+            this->blocks = blocks;
+            next = 0;
+            busy = pool.size();
+            round++;
+        }
+        wake.notify_all();
+        work();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+    }
+
+private:
+    void work() {
+        for (int block = next++; block < blocks; block = next++)
+            (*task)(block);
+    }
+
+    void loop() {
+        ull seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || round != seen; });
+                if (stopping)
+                    return;
+                seen = round;
+            }
+            work();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0)
+                done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> pool;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(int)>* task = nullptr;
+    int blocks = 0;
+    std::atomic<int> next{0};
+    int busy = 0;
+    ull round = 0;
+    bool stopping = false;
+};
+
+// Hands frames from one stage to the next, blocking push() while capacity frames are waiting
+template<class T>
+class Queue {
+public:
+    explicit Queue(size_t capacity) : capacity(capacity) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(item);
+        changed.notify_all();
     }
-    for (int i = 0; i < output.size(); i++) {
-        if (output[i])
-            fclose(output[i]);
+
+    T pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return !items.empty(); });
+        T item = items.front();
+        items.pop_front();
+        changed.notify_all();
+        return item;
+    }
+
+private:
+    size_t capacity;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+// Conversions of both depths resolved once for the whole run, the sides whose planar chroma is subsampled, and
+// the sides in YCoCg-R planes, which go through ycocgR() instead of the conversions
+struct Plan {
+    ColorSpace::Conversion<uchar> narrow;
+    ColorSpace::Conversion<uint16_t> wide;
+    bool subsampleFrom, subsampleTo;
+    bool ycocgRFrom, ycocgRTo;
+};
+
+// Header of buffer k of the inputs or outputs of an image with the given header, smaller for subsampled chroma
+Netpbm::Header planeOf(Netpbm::Header image, int k, bool subsampled) {
+    if (subsampled && k > 0) {
+        image.width = (image.width + chromaX - 1) / chromaX;
+        image.height = (image.height + chromaY - 1) / chromaY;
     }
+    return image;
 }
 
-void freeData() {
-    for (int i = 0; i < inputData.size(); i++)
-        delete [] inputData[i];
-    for (int i = 0; i < outputData.size(); i++) {
-        delete [] outputData[i];
+// Row of buffer k that image row starts at; rows past the last one give the end of the buffer
+int planeRow(int row, int k, bool subsampled) {
+    return subsampled && k > 0 ? (row + chromaY - 1) / chromaY : row;
+}
+
+// Maps the inputs of the frame's job and sizes its outputs. Returns 0 or the error of the first input that fails.
+int read(Frame& frame, const Plan& plan) {
+    const Job& job = *frame.job;
+    int inputCount = job.inputPaths.size(), outputCount = job.outputPaths.size();
+    int inputChannels = (inputCount == 1 ? 3 : 1);
+    frame.inputData.clear();
+    for (int i = 0; i < inputCount; i++) {
+        Netpbm::Status status = Netpbm::read(job.inputPaths[i].c_str(), frame.images[i]);
+        const Netpbm::Header &header = frame.images[i].header;
+        Netpbm::Header expected = planeOf(frame.images[0].header, i, plan.subsampleFrom);
+        if (status == Netpbm::OK && (header.channels != inputChannels || header.maxval != expected.maxval ||
+                                     header.width != expected.width || header.height != expected.height))
+            status = Netpbm::BAD_HEADER;
+        if (status != Netpbm::OK)
+            return status == Netpbm::CANNOT_OPEN ? NO_INPUT
+                   : status == Netpbm::TRUNCATED ? INPUT_BROKEN : HEADER_PARSING;
+        frame.inputData.push_back(frame.images[i].pixels);
+    }
+    frame.header = frame.images[0].header;
+    frame.header.channels = (outputCount == 1 ? 3 : 1);
+    frame.header.plain = false;
+    if (outputCount == inputCount && !plan.subsampleFrom && !plan.subsampleTo) {
+        frame.outputData = frame.inputData;
+        return 0;
     }
-    delete picture;
+    frame.outputs.resize(outputCount);
+    frame.outputData.clear();
+    for (int i = 0; i < outputCount; i++) {
+        frame.outputs[i].resize(planeOf(frame.header, i, plan.subsampleTo).bytes());
+        frame.outputData.push_back(frame.outputs[i].data());
+    }
+    return 0;
+}
+
+// Returns 0 or the error of the first output that fails
+int write(const Frame& frame, const Plan& plan) {
+    for (size_t i = 0; i < frame.outputData.size(); i++) {
+        Netpbm::Status status = Netpbm::write(frame.job->outputPaths[i].c_str(),
+                                              planeOf(frame.header, i, plan.subsampleTo), frame.outputData[i]);
+        if (status != Netpbm::OK)
+            return status == Netpbm::CANNOT_CREATE ? NO_OUTPUT : OUTPUT_ERROR;
+    }
+    return 0;
 }
 
-void compose(int width, int height) {
-    if (inputData.size() > 1) {
-        picture = new uchar[width * height * 3];
-        int k = 0;
-        for (int i = 0; i < height * width; i++) {
-            picture[k++] = inputData[0][i];
-            picture[k++] = inputData[1][i];
-            picture[k++] = inputData[2][i];
+// One picture is interleaved, three are the planes of a planar image
+template<class T, class U>
+ColorSpace::Pixels<T> pixelsOf(U* const* data, int count) {
+    if (count == 1)
+        return ColorSpace::interleaved<T>(data[0]);
+    return ColorSpace::planar<T>(data[0], data[1], data[2]);
+}
+
+// count samples at data as values: the samples themselves in 8-bit images, decoded to 0..65535 into scratch in
+// 16-bit ones
+uchar* decoded(uchar* data, size_t, int, std::vector<uchar>&) {
+    return data;
+}
+
+uint16_t* decoded(uchar* data, size_t count, int depth, std::vector<uint16_t>& scratch) {
+    scratch.resize(count);
+    Netpbm::decode16(data, scratch.data(), count, depth);
+    return scratch.data();
+}
+
+// Where the values of count samples at data are put: data itself in 8-bit images, scratch in 16-bit ones until
+// encoded() writes them to data
+uchar* staged(uchar* data, size_t, std::vector<uchar>&) {
+    return data;
+}
+
+uint16_t* staged(uchar*, size_t count, std::vector<uint16_t>& scratch) {
+    scratch.resize(count);
+    return scratch.data();
+}
+
+void encoded(const uchar*, uchar*, size_t, int) {}
+
+void encoded(const uint16_t* values, uchar* data, size_t count, int depth) {
+    Netpbm::encode16(values, data, count, depth);
+}
+
+// Rows first..last - 1 of the image from the chroma rows they fall in, every chroma sample repeated over its cell
+template<class T>
+void upsample(const T* chroma, int chromaWidth, int first, int last, int width, T* full) {
+    for (int row = first; row < last; row++) {
+        const T* source = chroma + (size_t) (row / chromaY - first / chromaY) * chromaWidth;
+        T* target = full + (size_t) (row - first) * width;
+        for (int x = 0; x < width; x++)
+            target[x] = source[x / chromaX];
+    }
+}
+
+// Rounded box average of every chromaX by chromaY cell of rows first..last - 1; cells are cut at the image edges
+template<class T>
+void downsample(const T* full, int width, int first, int last, T* chroma, int chromaWidth) {
+    for (int row = first; row < last; row += chromaY) {
+        int rows = std::min(chromaY, last - row);
+        T* target = chroma + (size_t) ((row - first) / chromaY) * chromaWidth;
+        for (int x = 0; x < width; x += chromaX) {
+            int columns = std::min(chromaX, width - x), sum = 0;
+            for (int r = 0; r < rows; r++)
+                for (int c = 0; c < columns; c++)
+                    sum += full[(size_t) (row - first + r) * width + x + c];
+            target[x / chromaX] = (sum + rows * columns / 2) / (rows * columns);
         }
     }
-    else
-        picture = inputData[0];
 }
 
-void decompose(int width, int height) {
-    outputData.resize(3);
-    for (int i = 0; i < 3; i++) {
-        outputData[i] = new uchar[width * height];
+// Rows first..last - 1 of a frame through conversion. Subsampled chroma is converted at full size through rows of
+// scratch, upsampled from the input planes before and averaged into the output planes after, while they are still
+// in cache. Blocks start on even rows, so they cover whole chroma rows.
+template<class T>
+void convertBlock(ColorSpace::Conversion<T> conversion, const Plan& plan, const Frame& frame, int first, int last) {
+    thread_local std::vector<T> inputs[3], outputs[3], upsampled[3], full[3];
+    int width = frame.header.width, depth = frame.header.maxval;
+    int inputCount = frame.inputData.size(), outputCount = frame.outputData.size();
+    size_t pixels = (size_t) (last - first) * width;
+    T *in[3], *out[3], *converted[3];
+    for (int i = 0; i < inputCount; i++) {
+        int planeWidth = planeOf(frame.header, i, plan.subsampleFrom).width;
+        size_t rowSamples = (size_t) planeWidth * (inputCount == 1 ? 3 : 1);
+        int top = planeRow(first, i, plan.subsampleFrom), bottom = planeRow(last, i, plan.subsampleFrom);
+        in[i] = decoded(frame.inputData[i] + rowSamples * top * sizeof(T), rowSamples * (bottom - top), depth,
+                        inputs[i]);
+        if (plan.subsampleFrom && i > 0) {
+            upsampled[i].resize(pixels);
+            upsample(in[i], planeWidth, first, last, width, upsampled[i].data());
+            in[i] = upsampled[i].data();
+        }
     }
-    int k = 0;
-    for (int i = 0; i < height * 3; i++) {
-        for (int j = 0; j < width; j += 3) {
-            outputData[0][k] = picture[i * width + j];
-            outputData[1][k] = picture[i * width + j + 1];
-            outputData[2][k] = picture[i * width + j + 2];
-            k++;
+    for (int k = 0; k < outputCount; k++) {
+        size_t rowSamples = (size_t) planeOf(frame.header, k, plan.subsampleTo).width * (outputCount == 1 ? 3 : 1);
+        int top = planeRow(first, k, plan.subsampleTo), bottom = planeRow(last, k, plan.subsampleTo);
+        out[k] = converted[k] = staged(frame.outputData[k] + rowSamples * top * sizeof(T),
+                                       rowSamples * (bottom - top), outputs[k]);
+        if (plan.subsampleTo && k > 0) {
+            full[k].resize(pixels);
+            converted[k] = full[k].data();
         }
     }
+    conversion(pixelsOf<const T>(in, inputCount), pixelsOf<T>(converted, outputCount), pixels, options);
+    for (int k = 0; k < outputCount; k++) {
+        Netpbm::Header plane = planeOf(frame.header, k, plan.subsampleTo);
+        size_t rowSamples = (size_t) plane.width * (outputCount == 1 ? 3 : 1);
+        int top = planeRow(first, k, plan.subsampleTo), bottom = planeRow(last, k, plan.subsampleTo);
+        if (plan.subsampleTo && k > 0)
+            downsample(converted[k], width, first, last, out[k], plane.width);
+        encoded(out[k], frame.outputData[k] + rowSamples * top * sizeof(T), rowSamples * (bottom - top), depth);
+    }
 }
 
-void write(int width, int height, int format, int depth) {
-    if (output.size() == 1) {
-        int writeBytes = fprintf(output[0], "P%c\n%i %i\n%i\n", '6', width, height, depth);
-        unsigned int writeMembers = fwrite(picture, 1, width * height * 3, output[0]);
-        if (writeMembers < width * height * 3 || writeBytes == -1) {
-            error(OUTPUT_ERROR);
+// Converts the inputs of a frame into its outputs in one pass, whatever the layouts. Rows are independent, so the
+// workers take blocks of BLOCK_ROWS rows, each decoded, converted and encoded on its own for 16-bit samples.
+void convert(Workers& workers, const Plan& plan, const Frame& frame) {
+    int height = frame.header.height;
+    workers.run((height + BLOCK_ROWS - 1) / BLOCK_ROWS, [&](int block) {
+        int first = block * BLOCK_ROWS, last = std::min(first + BLOCK_ROWS, height);
+        if (frame.header.maxval <= 255)
+            convertBlock(plan.narrow, plan, frame, first, last);
+        else
+            convertBlock(plan.wide, plan, frame, first, last);
+    });
+}
+
+// -r: the job goes through strips of stripRows rows, each read from the input streams, converted by the workers and
+// written to the output streams before the next one is read, so memory is bounded by the strip size. Strips of
+// 4:2:0 images take an even number of rows. The outputs are written in place, not through a temporary file, so an
+// output that is also an input is refused as an argument error before any file is opened. Returns 0 or the error code.
+int stream(const Job& job, const Plan& plan, Workers& workers, Frame& strip, bool verbose) {
+    for (const std::string& input : job.inputPaths) {
+        for (const std::string& output : job.outputPaths) {
+            if (Netpbm::sameFile(input.c_str(), output.c_str()))
+                return ARGUMENTS;
         }
-        closeFiles();
-        freeData();
-        exit(1);
     }
+    int inputCount = job.inputPaths.size(), outputCount = job.outputPaths.size();
+    int inputChannels = (inputCount == 1 ? 3 : 1);
+    std::vector<FILE*> inputs, outputs;
+    std::vector<Netpbm::Header> headers(inputCount);
+    auto close = [&](int result) {
+        for (FILE* file : inputs)
+            fclose(file);
+        for (FILE* file : outputs) {
+            if (fclose(file) && !result)
+                result = OUTPUT_ERROR;
+        }
+        return result;
+    };
+    for (int i = 0; i < inputCount; i++) {
+        FILE* file = fopen(job.inputPaths[i].c_str(), "rb");
+        if (!file)
+            return close(NO_INPUT);
+        inputs.push_back(file);
+        if (Netpbm::readHeader(file, headers[i]) != Netpbm::OK)
+            return close(HEADER_PARSING);
+        Netpbm::Header expected = planeOf(headers[0], i, plan.subsampleFrom);
+        if (headers[i].channels != inputChannels || headers[i].maxval != expected.maxval ||
+            headers[i].width != expected.width || headers[i].height != expected.height)
+            return close(HEADER_PARSING);
+    }
+    Netpbm::Header header = headers[0];
+    header.channels = (outputCount == 1 ? 3 : 1);
+    header.plain = false;
+    if (verbose)
+        std::cout << header.height << " " << header.width << " " << headers[0].format() << " " << header.maxval << "\n";
+    for (int i = 0; i < outputCount; i++) {
+        FILE* file = fopen(job.outputPaths[i].c_str(), "wb");
+        if (!file)
+            return close(NO_OUTPUT);
+        outputs.push_back(file);
+        if (fputs(Netpbm::formatHeader(planeOf(header, i, plan.subsampleTo)).c_str(), file) == EOF)
+            return close(OUTPUT_ERROR);
+    }
+    int rows = (stripRows + chromaY - 1) / chromaY * chromaY;
+    strip.header = header;
+    strip.inputs.resize(inputCount);
+    strip.inputData.clear();
+    for (int i = 0; i < inputCount; i++) {
+        strip.inputs[i].resize(planeRow(rows, i, plan.subsampleFrom) * headers[i].rowBytes());
+        strip.inputData.push_back(strip.inputs[i].data());
+    }
+    if (outputCount == inputCount && !plan.subsampleFrom && !plan.subsampleTo)
+        strip.outputData = strip.inputData;
     else {
-        for (int i = 0; i < output.size(); i++) {
-            int writeBytes = fprintf(output[i], "P%c\n%i %i\n%i\n", '5', width, height, depth);
-            if (writeBytes == -1) {
-                error(OUTPUT_ERROR);
-                closeFiles();
-                freeData();
-                exit(1);
-            }
+        strip.outputs.resize(outputCount);
+        strip.outputData.clear();
+        for (int i = 0; i < outputCount; i++) {
+            strip.outputs[i].resize(planeRow(rows, i, plan.subsampleTo) *
+                                    planeOf(header, i, plan.subsampleTo).rowBytes());
+            strip.outputData.push_back(strip.outputs[i].data());
         }
-        decompose(width, height);
-        for (int i = 0; i < outputData.size(); i++) {
-            unsigned int writeMembers = fwrite(outputData[i], 1, width * height, output[i]);
-            if (writeMembers < width * height) {
-                error(OUTPUT_ERROR);
-                closeFiles();
-                freeData();
-                exit(1);
-            }
+    }
+    for (int first = 0; first < header.height; first += rows) {
+        int last = std::min(first + rows, header.height);
+        strip.header.height = last - first;
+        for (int i = 0; i < inputCount; i++) {
+            size_t samples = (size_t) (planeRow(last, i, plan.subsampleFrom) - planeRow(first, i, plan.subsampleFrom)) *
+                             headers[i].width * inputChannels;
+            if (Netpbm::readSamples(inputs[i], headers[i], strip.inputData[i], samples) != Netpbm::OK)
+                return close(INPUT_BROKEN);
+        }
+        convert(workers, plan, strip);
+        for (int i = 0; i < outputCount; i++) {
+            size_t bytes = (planeRow(last, i, plan.subsampleTo) - planeRow(first, i, plan.subsampleTo)) *
+                           planeOf(header, i, plan.subsampleTo).rowBytes();
+            if (fwrite(strip.outputData[i], 1, bytes, outputs[i]) != bytes)
+                return close(OUTPUT_ERROR);
         }
     }
+    return close(0);
 }
 
-void convert(const std::string& from, const std::string& to, int height, int width) {
-    for (int i = 0; i < height * 3; i++) {
-        for (int j = 0; j < width; j += 3) {
-            uchar comp1, comp2, comp3;
-            comp1 = picture[i * width + j];
-            comp2 = picture[i * width + j + 1];
-            comp3 = picture[i * width + j + 2];
+// Batch mode names the input of a frame that fails, a single image only gets the error code
+void report(const Job& job, int status, bool verbose) {
+    if (!verbose)
+        fprintf(stderr, "%s: ", job.inputPaths[0].c_str());
+    error(status);
+    if (!verbose)
+        fprintf(stderr, "\n");
+}
 
-            ColorSpace::Rgb rgb;
+// YCoCg-R on the command line: y takes an 8-bit plane, co and cg span -255..255 and take 16-bit planes with maxval
+// 510 that hold chroma + CHROMA_BIAS, so RGB to YCoCg-R and back gives every pixel back. The other side is 8-bit RGB.
+const char* YCOCG_R = "YCoCg-R";
+const int CHROMA_BIAS = 255;
 
-            if (from == "RGB") {
-                rgb.r = comp1;
-                rgb.g = comp2;
-                rgb.b = comp3;
-            }
-            else if (from == "HSL") {
-                ColorSpace::Hsl hsl(comp1, comp2, comp3);
-                hsl.toRgb(&rgb);
-            }
-            else if (from == "HSV") {
-                ColorSpace::Hsv hsv(comp1, comp2, comp3);
-                hsv.toRgb(&rgb);
+bool sameShape(const Netpbm::Header& first, const Netpbm::Header& second) {
+    return first.width == second.width && first.height == second.height && first.maxval == second.maxval &&
+           first.channels == second.channels;
+}
+
+// One job between RGB and YCoCg-R planes through the YCoCg-R kernels, whole images split into blocks of BLOCK_ROWS
+// rows across the workers like convert(). Returns 0 or the error code.
+int ycocgR(const Job& job, const Plan& plan, Workers& workers, bool verbose) {
+    int inputCount = job.inputPaths.size(), outputCount = job.outputPaths.size();
+    std::vector<Netpbm::Image> images(inputCount);
+    for (int i = 0; i < inputCount; i++) {
+        Netpbm::Status status = Netpbm::read(job.inputPaths[i].c_str(), images[i]);
+        if (status != Netpbm::OK)
+            return status == Netpbm::CANNOT_OPEN ? NO_INPUT
+                   : status == Netpbm::TRUNCATED ? INPUT_BROKEN : HEADER_PARSING;
+    }
+    Netpbm::Header rgb = images[0].header, luma, chroma;
+    rgb.plain = false;
+    rgb.channels = (plan.ycocgRTo ? inputCount : outputCount) == 1 ? 3 : 1;
+    luma = rgb;
+    luma.channels = 1;
+    chroma = luma;
+    chroma.maxval = 2 * CHROMA_BIAS;
+    for (int i = 0; i < inputCount; i++) {
+        Netpbm::Header expected = plan.ycocgRTo ? rgb : i == 0 ? luma : chroma;
+        if (rgb.maxval != 255 || !sameShape(images[i].header, expected))
+            return HEADER_PARSING;
+    }
+    if (verbose)
+        std::cout << rgb.height << " " << rgb.width << " " << images[0].header.format() << " " << rgb.maxval << "\n";
+    std::vector<std::vector<uchar>> outputs(outputCount);
+    uchar *in[3], *out[3];
+    for (int i = 0; i < inputCount; i++)
+        in[i] = images[i].pixels;
+    for (int k = 0; k < outputCount; k++) {
+        outputs[k].resize((plan.ycocgRFrom ? rgb : k == 0 ? luma : chroma).bytes());
+        out[k] = outputs[k].data();
+    }
+    int width = rgb.width, height = rgb.height;
+    workers.run((height + BLOCK_ROWS - 1) / BLOCK_ROWS, [&](int block) {
+        thread_local std::vector<int16_t> planes[2];
+        thread_local std::vector<uint16_t> values;
+        size_t first = (size_t) block * BLOCK_ROWS * width;
+        size_t count = (size_t) std::min(BLOCK_ROWS, height - block * BLOCK_ROWS) * width;
+        values.resize(count);
+        for (std::vector<int16_t>& plane : planes)
+            plane.resize(count);
+        if (plan.ycocgRTo) {
+            ColorSpace::rgbToYcocgR(pixelsOf<const uchar>(in, inputCount).at(first), out[0] + first,
+                                    planes[0].data(), planes[1].data(), count, options.isa);
+            for (int k = 1; k < 3; k++) {
+                for (size_t i = 0; i < count; i++)
+                    values[i] = planes[k - 1][i] + CHROMA_BIAS;
+                Netpbm::encode16(values.data(), out[k] + 2 * first, count);
             }
-            else if (from == "YCbCr.601") {
-                ColorSpace::Ycbcr601 ycbcr601(comp1, comp2, comp3);
-                ycbcr601.toRgb(&rgb);
+        } else {
+            for (int k = 1; k < 3; k++) {
+                Netpbm::decode16(in[k] + 2 * first, values.data(), count);
+                for (size_t i = 0; i < count; i++)
+                    planes[k - 1][i] = values[i] - CHROMA_BIAS;
             }
-            else if (from == "YCbCr.709") {
-                ColorSpace::Ycbcr709 ycbcr709(comp1, comp2, comp3);
-                ycbcr709.toRgb(&rgb);
+            ColorSpace::ycocgRToRgb(in[0] + first, planes[0].data(), planes[1].data(),
+                                    pixelsOf<uchar>(out, outputCount).at(first), count, options.isa);
+        }
+    });
+    for (int k = 0; k < outputCount; k++) {
+        Netpbm::Status status = Netpbm::write(job.outputPaths[k].c_str(),
+                                              plan.ycocgRFrom ? rgb : k == 0 ? luma : chroma, out[k]);
+        if (status != Netpbm::OK)
+            return status == Netpbm::CANNOT_CREATE ? NO_OUTPUT : OUTPUT_ERROR;
+    }
+    return 0;
+}
+
+// Runs the jobs through three stages on their own threads: the next frame is read while the current one converts
+// and the previous one is written, so disk I/O overlaps the conversion. At most FRAMES frames are in flight. A frame
+// that fails is reported and skipped; the result is 1 when any did. verbose prints the sizes of a single image.
+// With -r the jobs stream one after another instead, and so do YCoCg-R jobs.
+int run(const std::vector<Job>& jobs, const Plan& plan, bool verbose) {
+    bool failed = false;
+    if (plan.ycocgRFrom || plan.ycocgRTo) {
+        Workers workers(threads);
+        for (const Job& job : jobs) {
+            int status = ycocgR(job, plan, workers, verbose);
+            if (status) {
+                report(job, status, verbose);
+                failed = true;
             }
-            else if (from == "CMY") {
-                ColorSpace::Cmy cmy(comp1, comp2, comp3);
-                cmy.toRgb(&rgb);
+        }
+        return failed ? 1 : 0;
+    }
+    if (stripRows > 0) {
+        Workers workers(threads);
+        Frame strip;
+        for (const Job& job : jobs) {
+            int status = stream(job, plan, workers, strip, verbose);
+            if (status) {
+                report(job, status, verbose);
+                failed = true;
             }
-            else if (from == "YCoCg") {
-                ColorSpace::Ycocg ycocg(comp1, comp2, comp3);
-                ycocg.toRgb(&rgb);
+        }
+        return failed ? 1 : 0;
+    }
+    std::vector<Frame> frames(FRAMES);
+    Queue<Frame*> idle(FRAMES), loaded(FRAMES), converted(FRAMES);
+    for (Frame& frame : frames)
+        idle.push(&frame);
+    Workers workers(threads);
+    std::thread reader([&] {
+        for (const Job& job : jobs) {
+            Frame* frame = idle.pop();
+            frame->job = &job;
+            frame->status = read(*frame, plan);
+            if (verbose && !frame->status)
+                std::cout << frame->header.height << " " << frame->header.width << " "
+                          << frame->images[0].header.format() << " " << frame->header.maxval << "\n";
+            loaded.push(frame);
+        }
+        loaded.push(nullptr);
+    });
+    std::thread writer([&] {
+        while (Frame* frame = converted.pop()) {
+            if (!frame->status)
+                frame->status = write(*frame, plan);
+            if (frame->status) {
+                report(*frame->job, frame->status, verbose);
+                failed = true;
             }
+            for (Netpbm::Image& image : frame->images)
+                image.file.close();
+            idle.push(frame);
+        }
+    });
+    while (Frame* frame = loaded.pop()) {
+        if (!frame->status)
+            convert(workers, plan, *frame);
+        converted.push(frame);
+    }
+    converted.push(nullptr);
+    reader.join();
+    writer.join();
+    return failed ? 1 : 0;
+}
 
+// A manifest line is a job in the form of the -i and -o arguments: a count and that many input paths, then a count
+// and that many output paths. Empty lines are skipped.
+bool readManifest(const char* path, std::vector<Job>& jobs) {
+    std::ifstream manifest(path);
+    if (!manifest)
+        return false;
+    std::string line;
+    while (std::getline(manifest, line)) {
+        std::istringstream fields(line);
+        Job job;
+        int count;
+        if (!(fields >> count))
+            continue;
+        for (std::string path; count > 0 && fields >> path; count--)
+            job.inputPaths.push_back(path);
+        fields >> count;
+        for (std::string path; count > 0 && fields >> path; count--)
+            job.outputPaths.push_back(path);
+        jobs.push_back(job);
+    }
+    return true;
+}
 
-            if (to == "RGB") {
-                picture[i * width + j] = rgb.r;
-                picture[i * width + j + 1] = rgb.g;
-                picture[i * width + j + 2] = rgb.b;
-            }
-            else if (to == "HSV") {
-                ColorSpace::Hsv hsv;
-                rgb.toHsv(&hsv);
-                picture[i * width + j] = hsv.h;
-                picture[i * width + j + 1] = hsv.s;
-                picture[i * width + j + 2] = hsv.v;
-            }
-            else if (to == "HSL") {
-                ColorSpace::Hsl hsl;
-                rgb.toHsl(&hsl);
-                picture[i * width + j] = hsl.h;
-                picture[i * width + j + 1] = hsl.s;
-                picture[i * width + j + 2] = hsl.l;
-            }
-            else if (to == "YCbCr.601") {
-                ColorSpace::Ycbcr601 ycbcr601;
-                rgb.toYcbcr601(&ycbcr601);
-                picture[i * width + j] = ycbcr601.y;
-                picture[i * width + j + 1] = ycbcr601.cb;
-                picture[i * width + j + 2] = ycbcr601.cr;
-            }
-            else if (to == "YCbCr.709") {
-                ColorSpace::Ycbcr709 ycbcr709;
-                rgb.toYcbcr709(&ycbcr709);
-                picture[i * width + j] = ycbcr709.y;
-                picture[i * width + j + 1] = ycbcr709.cb;
-                picture[i * width + j + 2] = ycbcr709.cr;
-            }
-            else if (to == "CMY") {
-                ColorSpace::Cmy cmy;
-                rgb.toCmy(&cmy);
-                picture[i * width + j] = cmy.c;
-                picture[i * width + j + 1] = cmy.m;
-                picture[i * width + j + 2] = cmy.y;
-            }
-            else if (to == "YCoCg") {
-                ColorSpace::Ycocg ycocg;
-                rgb.toYcocg(&ycocg);
-                picture[i * width + j] = ycocg.y;
-                picture[i * width + j + 1] = ycocg.co;
-                picture[i * width + j + 2] = ycocg.cg;
+// Every .ppm of a directory, in name order, to the file of the same name in another
+bool readDirectory(const char* input, const char* output, std::vector<Job>& jobs) {
+    std::error_code failure;
+    std::vector<std::filesystem::path> paths;
+    for (const auto& entry : std::filesystem::directory_iterator(input, failure)) {
+        if (entry.path().extension() == ".ppm")
+            paths.push_back(entry.path());
+    }
+    if (failure)
+        return false;
+    std::sort(paths.begin(), paths.end());
+    for (const std::filesystem::path& path : paths)
+        jobs.push_back({{path.string()}, {(std::filesystem::path(output) / path.filename()).string()}});
+    return true;
+}
+
+const char* spaceNames[] = {"RGB", "HSL", "HSV", "YCbCr.601", "YCbCr.709", "YCoCg", "CMY"};
+
+// Index of a space given on the command line in ColorSpace::Spaces, -1 when there is no such space
+int spaceOf(const std::string& name) {
+    for (int space = ColorSpace::RGB; space <= ColorSpace::CMY; space++) {
+        if (name == spaceNames[space])
+            return space;
+    }
+    return -1;
+}
+
+// Megapixels per second of the conversion plan of every pair on a synthetic image, a row per source space
+void benchmark() {
+    const int pixels = 2048 * 2048, rounds = 3;
+    std::vector<uchar> source(pixels * 3), data(pixels * 3);
+    uint seed = 1;
+    for (int i = 0; i < pixels * 3; i++) {
+        seed = seed * 1103515245 + 12345;
+        source[i] = seed >> 24;
+    }
+    printf("from \\ to  ");
+    for (const char* name : spaceNames)
+        printf("%11s", name);
+    printf("\n");
+    for (int from = ColorSpace::RGB; from <= ColorSpace::CMY; from++) {
+        printf("%-11s", spaceNames[from]);
+        for (int to = ColorSpace::RGB; to <= ColorSpace::CMY; to++) {
+            ColorSpace::Conversion<uchar> convert = ColorSpace::conversion<uchar>((ColorSpace::Spaces) from,
+                                                                                 (ColorSpace::Spaces) to);
+            double seconds = 0;
+            for (int r = 0; r < rounds; r++) {
+                auto start = std::chrono::steady_clock::now();
+                convert(ColorSpace::interleaved<const uchar>(source.data()), ColorSpace::interleaved(data.data()),
+                        pixels, options);
+                seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
             }
+            printf("%11.1f", (double) pixels * rounds / seconds / 1e6);
+        }
+        printf("\n");
+    }
+}
+
+// One pixel through the ColorSpace objects, the double path the kernels are checked against. Conversions to Rgb
+// start from black like the conversion loops do, Hsv::toRgb leaves it so for hue 255.
+template<class T>
+void objectPixel(ColorSpace::Spaces space, bool fromRgb, T* pixel) {
+    ColorSpace::Rgb<T> rgb;
+    if (fromRgb)
+        rgb = ColorSpace::Rgb<T>(pixel[0], pixel[1], pixel[2]);
+    T out[3];
+    if (space == ColorSpace::YCbCr601) {
+        ColorSpace::Ycbcr601<T> ycbcr601(pixel[0], pixel[1], pixel[2]);
+        if (fromRgb)
+            rgb.toYcbcr601(&ycbcr601);
+        else
+            ycbcr601.toRgb(&rgb);
+        out[0] = fromRgb ? ycbcr601.y : rgb.r;
+        out[1] = fromRgb ? ycbcr601.cb : rgb.g;
+        out[2] = fromRgb ? ycbcr601.cr : rgb.b;
+    }
+    else if (space == ColorSpace::YCbCr709) {
+        ColorSpace::Ycbcr709<T> ycbcr709(pixel[0], pixel[1], pixel[2]);
+        if (fromRgb)
+            rgb.toYcbcr709(&ycbcr709);
+        else
+            ycbcr709.toRgb(&rgb);
+        out[0] = fromRgb ? ycbcr709.y : rgb.r;
+        out[1] = fromRgb ? ycbcr709.cb : rgb.g;
+        out[2] = fromRgb ? ycbcr709.cr : rgb.b;
+    }
+    else if (space == ColorSpace::HSV) {
+        ColorSpace::Hsv<T> hsv(pixel[0], pixel[1], pixel[2]);
+        if (fromRgb)
+            rgb.toHsv(&hsv);
+        else
+            hsv.toRgb(&rgb);
+        out[0] = fromRgb ? hsv.h : rgb.r;
+        out[1] = fromRgb ? hsv.s : rgb.g;
+        out[2] = fromRgb ? hsv.v : rgb.b;
+    }
+    else if (space == ColorSpace::HSL) {
+        ColorSpace::Hsl<T> hsl(pixel[0], pixel[1], pixel[2]);
+        if (fromRgb)
+            rgb.toHsl(&hsl);
+        else
+            hsl.toRgb(&rgb);
+        out[0] = fromRgb ? hsl.h : rgb.r;
+        out[1] = fromRgb ? hsl.s : rgb.g;
+        out[2] = fromRgb ? hsl.l : rgb.b;
+    }
+    else {
+        ColorSpace::Ycocg<T> ycocg(pixel[0], pixel[1], pixel[2]);
+        if (fromRgb)
+            rgb.toYcocg(&ycocg);
+        else
+            ycocg.toRgb(&rgb);
+        out[0] = fromRgb ? ycocg.y : rgb.r;
+        out[1] = fromRgb ? ycocg.co : rgb.g;
+        out[2] = fromRgb ? ycocg.cg : rgb.b;
+    }
+    std::copy(out, out + 3, pixel);
+}
+
+// One row of check(): kernel at SCALAR and at the detected instruction set over the pixels of all, compared with
+// each other and with the double path
+template<class T, class Kernel>
+void checkKernel(const char* name, Kernel kernel, ColorSpace::Spaces space, bool fromRgb, const std::vector<T>& all) {
+    size_t count = all.size() / 3;
+    std::vector<T> scalar(all), vector(all), reference(all);
+    kernel(ColorSpace::interleaved<const T>(all.data()), ColorSpace::interleaved(scalar.data()), count,
+           ColorSpace::SCALAR);
+    kernel(ColorSpace::interleaved<const T>(all.data()), ColorSpace::interleaved(vector.data()), count,
+           options.isa);
+    for (size_t i = 0; i < count; i++)
+        objectPixel(space, fromRgb, &reference[3 * i]);
+    ull mismatches = 0, offByOne = 0, offByMore = 0;
+    for (size_t i = 0; i < count * 3; i++) {
+        mismatches += scalar[i] != vector[i];
+        int deviation = std::abs(scalar[i] - reference[i]);
+        offByOne += deviation == 1;
+        offByMore += deviation > 1;
+    }
+    printf("%-15s %16llu  %10llu  %11llu\n", name, mismatches, offByOne, offByMore);
+}
+
+// Every 8-bit pixel through each bulk kernel. The vector path has to match the scalar reference exactly; against
+// the double path the fixed-point kernels are off by one where truncation lands on the other side of an integer,
+// and by more only where the double path wraps around past 255 and the kernels saturate. The HSV and HSL kernels
+// have no vector path and match the double path everywhere, through their cubes too when -l is given. The 16-bit
+// kernels take 2^24 pseudo-random pixels: YCoCg matches the double path exactly, YCbCr in single precision is off
+// by one here and there and by more where the double path wraps around past 65535.
+void check() {
+    struct {
+        const char* name;
+        ColorSpace::Kernel kernel;
+        ColorSpace::Spaces space;
+        bool fromRgb;
+    } kernels[] = {{"RGB->YCbCr.601", ColorSpace::rgbToYcbcr601, ColorSpace::YCbCr601, true},
+                   {"YCbCr.601->RGB", ColorSpace::ycbcr601ToRgb, ColorSpace::YCbCr601, false},
+                   {"RGB->YCbCr.709", ColorSpace::rgbToYcbcr709, ColorSpace::YCbCr709, true},
+                   {"YCbCr.709->RGB", ColorSpace::ycbcr709ToRgb, ColorSpace::YCbCr709, false},
+                   {"RGB->YCoCg", ColorSpace::rgbToYcocg, ColorSpace::YCoCg, true},
+                   {"YCoCg->RGB", ColorSpace::ycocgToRgb, ColorSpace::YCoCg, false},
+                   {"RGB->HSV", ColorSpace::rgbToHsv, ColorSpace::HSV, true},
+                   {"HSV->RGB", ColorSpace::hsvToRgb, ColorSpace::HSV, false},
+                   {"RGB->HSL", ColorSpace::rgbToHsl, ColorSpace::HSL, true},
+                   {"HSL->RGB", ColorSpace::hslToRgb, ColorSpace::HSL, false}};
+    struct {
+        const char* name;
+        ColorSpace::WideKernel kernel;
+        ColorSpace::Spaces space;
+        bool fromRgb;
+    } wideKernels[] = {{"RGB->YCbCr.601", ColorSpace::rgbToYcbcr601, ColorSpace::YCbCr601, true},
+                       {"YCbCr.601->RGB", ColorSpace::ycbcr601ToRgb, ColorSpace::YCbCr601, false},
+                       {"RGB->YCbCr.709", ColorSpace::rgbToYcbcr709, ColorSpace::YCbCr709, true},
+                       {"YCbCr.709->RGB", ColorSpace::ycbcr709ToRgb, ColorSpace::YCbCr709, false},
+                       {"RGB->YCoCg", ColorSpace::rgbToYcocg, ColorSpace::YCoCg, true},
+                       {"YCoCg->RGB", ColorSpace::ycocgToRgb, ColorSpace::YCoCg, false}};
+    const size_t count = 1 << 24;
+    std::vector<uchar> all(count * 3);
+    for (size_t i = 0; i < count; i++) {
+        all[3 * i] = i >> 16;
+        all[3 * i + 1] = i >> 8;
+        all[3 * i + 2] = i;
+    }
+    const char* isaNames[] = {"scalar", "ssse3", "avx2"};
+    printf("kernel          %6s != scalar  off by one  off by more\n", isaNames[options.isa]);
+    for (const auto& k : kernels)
+        checkKernel(k.name, k.kernel, k.space, k.fromRgb, all);
+    std::vector<uint16_t> wide(count * 3);
+    ull state = 1;
+    for (size_t i = 0; i < count * 3; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        wide[i] = state >> 48;
+    }
+    printf("16-bit kernel   %6s != scalar  off by one  off by more\n", isaNames[options.isa]);
+    for (const auto& k : wideKernels)
+        checkKernel(k.name, k.kernel, k.space, k.fromRgb, wide);
+}
+
+// Every 8-bit pixel through YCoCg-R and back at each instruction set up to the detected one, from interleaved and
+// planar pixels: the round trip has to give every pixel back and the chroma planes have to match the scalar ones.
+// Throughput is the best of a few rounds over the same 2^24 pixels.
+void roundTrip() {
+    const size_t count = 1 << 24;
+    const int rounds = 3;
+    std::vector<uchar> all(count * 3), back(count * 3), y(count), scalarY(count);
+    std::vector<int16_t> co(count), cg(count), scalarCo(count), scalarCg(count);
+    for (size_t i = 0; i < count; i++) {
+        all[3 * i] = i >> 16;
+        all[3 * i + 1] = i >> 8;
+        all[3 * i + 2] = i;
+    }
+    ColorSpace::rgbToYcocgR(ColorSpace::interleaved<const uchar>(all.data()), scalarY.data(), scalarCo.data(),
+                            scalarCg.data(), count, ColorSpace::SCALAR);
+    const char* isaNames[] = {"scalar", "ssse3", "avx2"};
+    printf("isa     forward Mpx/s  inverse Mpx/s  != scalar  round-trip errors\n");
+    for (int isa = ColorSpace::SCALAR; isa <= options.isa; isa++) {
+        double forward = 0, inverse = 0;
+        for (int r = 0; r < rounds; r++) {
+            auto start = std::chrono::steady_clock::now();
+            ColorSpace::rgbToYcocgR(ColorSpace::interleaved<const uchar>(all.data()), y.data(), co.data(), cg.data(),
+                                    count, (ColorSpace::Isa) isa);
+            auto middle = std::chrono::steady_clock::now();
+            ColorSpace::ycocgRToRgb(y.data(), co.data(), cg.data(), ColorSpace::interleaved(back.data()), count,
+                                    (ColorSpace::Isa) isa);
+            auto end = std::chrono::steady_clock::now();
+            forward = std::max(forward, count / std::chrono::duration<double>(middle - start).count() / 1e6);
+            inverse = std::max(inverse, count / std::chrono::duration<double>(end - middle).count() / 1e6);
         }
+        ull mismatches = 0, errors = 0;
+        for (size_t i = 0; i < count; i++)
+            mismatches += y[i] != scalarY[i] || co[i] != scalarCo[i] || cg[i] != scalarCg[i];
+        for (size_t i = 0; i < count * 3; i++)
+            errors += back[i] != all[i];
+        // the planar round trip, pixels of plane k at k * count
+        std::vector<uchar> planes(count * 3);
+        for (size_t i = 0; i < count * 3; i++)
+            planes[i % 3 * count + i / 3] = all[i];
+        ColorSpace::rgbToYcocgR(ColorSpace::planar<const uchar>(&planes[0], &planes[count], &planes[2 * count]),
+                                y.data(), co.data(), cg.data(), count, (ColorSpace::Isa) isa);
+        std::fill(planes.begin(), planes.end(), 0);
+        ColorSpace::ycocgRToRgb(y.data(), co.data(), cg.data(),
+                                ColorSpace::planar(&planes[0], &planes[count], &planes[2 * count]), count,
+                                (ColorSpace::Isa) isa);
+        for (size_t i = 0; i < count * 3; i++)
+            errors += planes[i % 3 * count + i / 3] != all[i];
+        printf("%-7s %13.1f  %13.1f  %9llu  %17llu\n", isaNames[isa], forward, inverse, mismatches, errors);
     }
 }
 
 int main(int argc, char* argv[]) {
     std::string from;
     std::string to;
-    int inputCount, outputCount;
+    Job single;
+    std::vector<Job> jobs;
+    threads = std::max((int) std::thread::hardware_concurrency(), 1);
     for (int i = 0; i < argc; i++) {
         if (!strcmp(argv[i], "-f")) {
             i++;
@@ -208,67 +868,105 @@ int main(int argc, char* argv[]) {
             i++;
             to = argv[i];
         }
-        else if (!strcmp(argv[i], "-i")) {
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
             i++;
-            inputCount = atoi(argv[i]);
+            threads = std::max(atoi(argv[i]), 1);
+        }
+        else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
             i++;
-            int cur = i;
-            for (; i < cur + inputCount; i++) {
-                input.emplace_back(fopen(argv[i], "rb"));
-                if (!input[input.size() - 1]) {
-                    closeFiles();
-                    error(NO_INPUT);
-                    return 1;
-                }
+            options.fixedPoint = !strcmp(argv[i], "fixed");
+        }
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "scalar"))
+                options.isa = ColorSpace::SCALAR;
+            else if (!strcmp(argv[i], "ssse3") && options.isa >= ColorSpace::SSSE3)
+                options.isa = ColorSpace::SSSE3;
+        }
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            i++;
+            ColorSpace::cubeDirectory = argv[i];
+        }
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            i++;
+            stripRows = std::max(atoi(argv[i]), 0);
+        }
+        else if (!strcmp(argv[i], "-u") && i + 1 < argc) {
+            i++;
+            chromaX = !strcmp(argv[i], "422") || !strcmp(argv[i], "420") ? 2 : !strcmp(argv[i], "444") ? 1 : 0;
+            chromaY = !strcmp(argv[i], "420") ? 2 : 1;
+        }
+        else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+            i++;
+            if (!readManifest(argv[i], jobs)) {
+                error(NO_INPUT);
+                return 1;
             }
-            i--;
         }
-        else if (!strcmp(argv[i], "-o")) {
+        else if (!strcmp(argv[i], "-d") && i + 2 < argc) {
+            if (!readDirectory(argv[i + 1], argv[i + 2], jobs)) {
+                error(NO_INPUT);
+                return 1;
+            }
+            i += 2;
+        }
+        else if (!strcmp(argv[i], "-b")) {
+            benchmark();
+            return 0;
+        }
+        else if (!strcmp(argv[i], "-c")) {
+            check();
+            return 0;
+        }
+        else if (!strcmp(argv[i], "-y")) {
+            roundTrip();
+            return 0;
+        }
+        else if (!strcmp(argv[i], "-i")) {
             i++;
-            outputCount = atoi(argv[i]);
+            int inputCount = atoi(argv[i]);
+            for (int k = 0; k < inputCount && i + 1 < argc; k++)
+                single.inputPaths.push_back(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-o")) {
             i++;
-            int cur = i;
-            for (; i < cur + outputCount; i++) {
-                output.emplace_back(fopen(argv[i], "wb"));
-                std::string out = argv[i];
-                std::cout << out << "\n";
-                if (!output[output.size() - 1]) {
-                    closeFiles();
-                    error(NO_OUTPUT);
-                    return 1;
-                }
+            int outputCount = atoi(argv[i]);
+            for (int k = 0; k < outputCount && i + 1 < argc; k++) {
+                single.outputPaths.push_back(argv[++i]);
+                std::cout << single.outputPaths.back() << "\n";
             }
         }
     }
-    char format;
-    int width, height, depth;
-    for (auto file : input) {
-        int parsed = fscanf(file, "P%c\n%i %i\n%i\n", &format, &width, &height, &depth);
-        if (parsed != 4 || (format == '5' && inputCount == 1) || (format == '6' && inputCount == 3)) {
-            error(HEADER_PARSING);
-            closeFiles();
-            return 1;
-        }
+    bool verbose = jobs.empty();
+    if (verbose)
+        jobs.push_back(single);
+    int fromSpace = spaceOf(from), toSpace = spaceOf(to);
+    // YCoCg-R pairs with RGB only and is not in ColorSpace::Spaces; the conversions resolved beside it go unused
+    bool ycocgRFrom = from == YCOCG_R && toSpace == ColorSpace::RGB;
+    bool ycocgRTo = to == YCOCG_R && fromSpace == ColorSpace::RGB;
+    if (ycocgRFrom || ycocgRTo)
+        fromSpace = toSpace = ColorSpace::RGB;
+    bool subsampled = chromaX * chromaY > 1;
+    bool ycbcrFrom = fromSpace == ColorSpace::YCbCr601 || fromSpace == ColorSpace::YCbCr709;
+    bool ycbcrTo = toSpace == ColorSpace::YCbCr601 || toSpace == ColorSpace::YCbCr709;
+    bool valid = fromSpace >= 0 && toSpace >= 0 && chromaX > 0 && (!subsampled || ycbcrFrom || ycbcrTo);
+    for (const Job& job : jobs) {
+        int inputCount = job.inputPaths.size(), outputCount = job.outputPaths.size();
+        valid &= (inputCount == 1 || inputCount == 3) && (outputCount == 1 || outputCount == 3);
+        // subsampled chroma only exists in planes of its own
+        valid &= !(subsampled && ycbcrFrom && inputCount != 3) && !(subsampled && ycbcrTo && outputCount != 3);
+        // YCoCg-R planes differ in depth, so they are always three files; whole images only, no -r
+        valid &= !(ycocgRFrom && inputCount != 3) && !(ycocgRTo && outputCount != 3);
+        valid &= !((ycocgRFrom || ycocgRTo) && stripRows > 0);
     }
-    std::cout << from << " " << to << " " << inputCount << " " << outputCount << "\n";
-    std::cout << height << " " << width << " " << format << " " << depth << "\n";
-    int inputChannels = (inputCount == 1 ? 3 : 1);
-    int outputChannels = (outputCount == 1 ? 3 : 1);
-    inputData.resize(inputCount);
-    for (int i = 0; i < input.size(); i++) {
-        inputData[i] = new uchar[height * width * inputChannels];
-        ull size = fread(inputData[i], 1, width * height * inputChannels, input[i]);
-        if (size != width * height * inputChannels) {
-            error(INPUT_BROKEN);
-            freeData();
-            closeFiles();
-            return 1;
-        }
-    }
-    compose(width, height);
-    convert(from, to, height, width);
-    write(width, height, format, depth);
-    closeFiles();
-    freeData();
-    return 0;
+    if (!valid) {
+        error(ARGUMENTS);
+        return 1;
+    }
+    if (verbose)
+        std::cout << from << " " << to << " " << single.inputPaths.size() << " " << single.outputPaths.size() << "\n";
+    Plan plan = {ColorSpace::conversion<uchar>((ColorSpace::Spaces) fromSpace, (ColorSpace::Spaces) toSpace),
+                 ColorSpace::conversion<uint16_t>((ColorSpace::Spaces) fromSpace, (ColorSpace::Spaces) toSpace),
+                 subsampled && ycbcrFrom, subsampled && ycbcrTo, ycocgRFrom, ycocgRTo};
+    return run(jobs, plan, verbose);
 }